@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+# expression pedal shutdown stress test (needs a running JACK server)
+#
+# Starts expression-pedal again and again with socket clients, a control
+# socket client and a shared memory segment attached, stops it with SIGTERM
+# at a random moment and checks that every run exits with 0 within
+# “SHUTDOWN_TIMEOUT_S” and leaves neither the control socket nor the shared
+# memory segment behind. For instance:
+#   ./shutdown_stress.py ./build/expression-pedal 30
+
+import os
+import random
+import signal
+import socket
+import subprocess
+import tempfile
+import threading
+from sys  import argv, stderr, exit
+from time import monotonic, sleep
+
+
+DEFAULT_BINARY = './build/expression-pedal'
+DEFAULT_RUNS   = 30
+SOCKET_PORT    = 31416 # default port of “--socket”
+START_TIMEOUT  = 3 # in seconds, for the sockets to show up
+
+# Must be in sync with “SHUTDOWN_TIMEOUT_S” in “src/main.c”
+SHUTDOWN_TIMEOUT_S = 5
+
+
+def read_until_closed(s):
+  try:
+    s.settimeout(SHUTDOWN_TIMEOUT_S * 2)
+    while s.recv(4096): pass
+  except OSError:
+    pass
+  finally:
+    s.close()
+
+
+def connect(family, address):
+  deadline = monotonic() + START_TIMEOUT
+
+  while True:
+    s = socket.socket(family, socket.SOCK_STREAM)
+
+    try:
+      s.connect(address)
+      return s
+    except OSError:
+      s.close()
+      if monotonic() >= deadline: raise
+      sleep(0.05)
+
+
+def attach_client(family, address, command=None):
+  s = connect(family, address)
+  if command is not None: s.sendall(command)
+  threading.Thread(target=read_until_closed, args=(s,), daemon=True).start()
+
+
+def run(binary, number, directory):
+  control_path = os.path.join(directory, 'control.sock')
+  shm_name     = '/expression-pedal-stress-{}'.format(os.getpid())
+  shm_path     = '/dev/shm' + shm_name
+
+  variants = [
+    ['-s', '--stats', '1', '--control', control_path, '--shm', shm_name],
+    ['-s', '--format', 'u16', '--max-clients', '2'],
+    ['--stats', '1'],
+  ]
+
+  args = variants[number % len(variants)]
+  log  = open(os.path.join(directory, 'stderr.log'), 'w+')
+
+  process = subprocess.Popen(
+    [binary, '-l', '-90', '-u', '-6'] + args,
+    stdout=subprocess.DEVNULL,
+    stderr=log
+  )
+
+  errors = []
+
+  try:
+    if '-s' in args:
+      for _ in range(3): attach_client(socket.AF_INET, ('127.0.0.1', SOCKET_PORT))
+    if '--control' in args:
+      attach_client(socket.AF_UNIX, control_path, b'show\n')
+  except OSError as e:
+    errors.append('failed to connect: {}'.format(e))
+
+  sleep(random.uniform(0.1, 0.5))
+
+  if process.poll() is not None:
+    errors.append('exited before SIGTERM with {}'.format(process.returncode))
+  else:
+    started = monotonic()
+    process.send_signal(signal.SIGTERM)
+
+    try:
+      code = process.wait(SHUTDOWN_TIMEOUT_S)
+      elapsed = monotonic() - started
+      if code != 0: errors.append('exited with {} in {:.3f} s'.format(code, elapsed))
+    except subprocess.TimeoutExpired:
+      errors.append('did not exit within {} s'.format(SHUTDOWN_TIMEOUT_S))
+      process.kill()
+      process.wait()
+
+  if os.path.exists(control_path):
+    errors.append('control socket is left behind')
+    os.unlink(control_path)
+
+  if os.path.exists(shm_path):
+    errors.append('shared memory segment is left behind')
+    os.unlink(shm_path)
+
+  if errors:
+    log.seek(0)
+    print('Run #{} ({}): {}'.format(number + 1, ' '.join(args), ', '.join(errors)), file=stderr)
+    print(''.join(log.readlines()[-5:]), end='', file=stderr)
+
+  log.close()
+  return not errors
+
+
+def main():
+  if len(argv) > 3:
+    print('Usage: {} [BINARY [RUNS]]'.format(argv[0]), file=stderr)
+    exit(1)
+
+  binary = argv[1] if len(argv) >= 2 else DEFAULT_BINARY
+  runs   = int(argv[2]) if len(argv) == 3 else DEFAULT_RUNS
+  failed = 0
+
+  with tempfile.TemporaryDirectory() as directory:
+    for number in range(runs):
+      if not run(binary, number, directory): failed += 1
+
+  print('{} run(s), {} failed'.format(runs, failed), file=stderr)
+  exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+  main()
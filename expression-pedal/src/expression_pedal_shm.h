@@ -0,0 +1,207 @@
+/**
+ * Author: Viacheslav Lotsmanov
+ * License: GNU/GPLv3 https://raw.githubusercontent.com/unclechu/pi-pedalboard/master/LICENSE
+ *
+ * Shared memory segment with the latest values of expression-pedal
+ * (see “--shm” option) and a client for the processes on the same host.
+ *
+ * The realtime thread of expression-pedal writes the segment directly,
+ * a reader maps it and reads the values with plain memory loads, no system
+ * calls are made unless the reader blocks waiting for a change:
+ *
+ *   EpShm *shm = ep_shm_open("/expression-pedal");
+ *   uint32_t generation = ep_shm_generation(shm);
+ *   EpShmValue value;
+ *
+ *   for (;;) {
+ *     generation = ep_shm_wait(shm, generation, -1);
+ *     for (unsigned int i = 0; i < shm->channels_count; ++i)
+ *       if (ep_shm_read(shm, i, &value)) printf("%u %u\n", i + 1, value.value);
+ *   }
+ *
+ * Every channel slot is guarded by a seqlock: the writer makes the sequence
+ * odd, writes the fields and makes it even again, the reader retries when
+ * the sequence was odd or changed while it was reading.
+ * The generation is incremented after every update of any channel, it is
+ * also the futex word the readers wait on.
+ *
+ * Define “_DEFAULT_SOURCE” (for “syscall()”) before including it and link
+ * with “-lrt” on systems with glibc older than 2.34.
+ */
+
+#ifndef EXPRESSION_PEDAL_SHM_H
+#define EXPRESSION_PEDAL_SHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define EP_SHM_MAGIC        0x48535045 // “EPSH” in little-endian
+#define EP_SHM_VERSION      1
+#define EP_SHM_MAX_CHANNELS 16
+
+// Latest value of a channel, a slot takes a cache line of its own.
+typedef struct {
+  _Atomic uint32_t    sequence; // seqlock, odd while the slot is being written
+  _Atomic uint32_t    frame_time; // JACK frame time the value was detected at
+  _Atomic uint8_t     value; // in range from 0 to 255
+  _Atomic uint16_t    value16; // in range from 0 to 65535
+  _Atomic float       position; // in range from 0 to 1
+  _Atomic uint64_t    time_ns; // “CLOCK_MONOTONIC” time of the update
+} __attribute__((aligned(64))) EpShmSlot;
+
+typedef struct {
+  // Set last by the writer, the segment is not ready until it is there.
+  _Atomic uint32_t    magic;
+  uint32_t            version;
+  uint32_t            channels_count;
+  uint32_t            sample_rate;
+  uint32_t            pid; // of the writer
+
+  // Incremented after every update (futex word, see “ep_shm_wait()”).
+  _Atomic uint32_t    generation __attribute__((aligned(64)));
+  // Amount of readers blocked in “ep_shm_wait()”, the writer only makes
+  // the wake-up system call when there are any.
+  _Atomic uint32_t    waiters;
+
+  EpShmSlot           channels[EP_SHM_MAX_CHANNELS];
+} EpShm;
+
+// A consistent copy of a slot (see “ep_shm_read()”).
+typedef struct {
+  uint8_t             value;
+  uint16_t            value16;
+  float               position;
+  uint32_t            frame_time;
+  uint64_t            time_ns;
+  uint32_t            sequence; // changes with every update of the slot
+} EpShmValue;
+
+// Maps the segment by its POSIX shared memory name. The segment is mapped
+// for writing too, “ep_shm_wait()” registers the reader as a waiter.
+// Returns “NULL” with “errno” set on failure, “EAGAIN” when the writer has
+// not initialized the segment yet.
+static inline EpShm *ep_shm_open(const char *name)
+{
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) return NULL;
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(EpShm)) {
+    if (errno == 0) errno = EINVAL;
+    close(fd);
+    return NULL;
+  }
+
+  EpShm *shm = mmap(NULL, sizeof(EpShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) return NULL;
+
+  if (
+    atomic_load_explicit(&shm->magic, memory_order_acquire) != EP_SHM_MAGIC
+    || shm->version != EP_SHM_VERSION
+  ) {
+    munmap(shm, sizeof(EpShm));
+    errno = EAGAIN;
+    return NULL;
+  }
+
+  return shm;
+}
+
+static inline void ep_shm_close(EpShm *shm)
+{
+  munmap(shm, sizeof(EpShm));
+}
+
+static inline uint32_t ep_shm_generation(const EpShm *shm)
+{
+  return atomic_load_explicit(
+    &((EpShm *)shm)->generation,
+    memory_order_acquire
+  );
+}
+
+// Reads the latest value of the channel (starting from 0) without blocking.
+// Returns “false” when there was no value yet.
+static inline bool ep_shm_read
+( const EpShm    *shm
+, unsigned int   channel
+, EpShmValue     *out
+)
+{
+  EpShmSlot *slot = &((EpShm *)shm)->channels[channel];
+  uint32_t before, after;
+
+  do {
+    before = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (before & 1) continue; // being written
+
+    out->value      = atomic_load_explicit(&slot->value, memory_order_relaxed);
+    out->value16    = atomic_load_explicit(&slot->value16, memory_order_relaxed);
+    out->position   = atomic_load_explicit(&slot->position, memory_order_relaxed);
+    out->frame_time = atomic_load_explicit(&slot->frame_time, memory_order_relaxed);
+    out->time_ns    = atomic_load_explicit(&slot->time_ns, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+  } while ((before & 1) || before != after);
+
+  out->sequence = before;
+  return before != 0;
+}
+
+// Blocks until the generation is not “generation” anymore, returns the new
+// one. Returns at once (without a system call) when it is already changed.
+// “timeout_ms” is negative to wait forever, on timeout the same generation
+// is returned.
+static inline uint32_t ep_shm_wait
+( EpShm          *shm
+, uint32_t       generation
+, int            timeout_ms
+)
+{
+  uint32_t current = ep_shm_generation(shm);
+  if (current != generation) return current;
+
+  struct timespec timeout = {
+    timeout_ms / 1000,
+    (long)(timeout_ms % 1000) * 1000000
+  };
+
+  // Registered before the generation is checked again, so either the writer
+  // sees the waiter or the waiter sees the new generation.
+  atomic_fetch_add_explicit(&shm->waiters, 1, memory_order_seq_cst);
+
+  while ((current = atomic_load_explicit(&shm->generation, memory_order_seq_cst))
+         == generation) {
+    long result = syscall(
+      SYS_futex,
+      &shm->generation,
+      FUTEX_WAIT,
+      generation,
+      timeout_ms < 0 ? NULL : &timeout,
+      NULL,
+      0
+    );
+
+    if (result != 0 && errno == ETIMEDOUT) {
+      current = ep_shm_generation(shm);
+      break;
+    }
+  }
+
+  atomic_fetch_sub_explicit(&shm->waiters, 1, memory_order_seq_cst);
+  return current;
+}
+
+#endif
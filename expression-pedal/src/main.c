@@ -5,20 +5,54 @@
 
 #define _POSIX_SOURCE   // Fix a warning about implicit declaration of “fileno”
 #define _DEFAULT_SOURCE // Fix a warning about implicit declaration of “usleep”
+#define _GNU_SOURCE     // For “pthread_setaffinity_np()” (see --pin-cpus)
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <math.h>
 #include <float.h>
+#include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <malloc.h>
+#include <sched.h>
 #include <signal.h>
 #include <jack/jack.h>
+#include <jack/midiport.h>
+
+#include "expression_pedal_shm.h"
+
+// SIMD backend of the sum-of-squares kernel is chosen at build time
+// (see “ARCH_FLAGS” in the Makefile).
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define SUM_OF_SQUARES_NEON
+#  define SUM_OF_SQUARES_BACKEND "NEON"
+#elif defined(__AVX__)
+#  include <immintrin.h>
+#  define SUM_OF_SQUARES_AVX
+#  define SUM_OF_SQUARES_BACKEND "AVX"
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#  define SUM_OF_SQUARES_SSE2
+#  define SUM_OF_SQUARES_BACKEND "SSE2"
+#else
+#  define SUM_OF_SQUARES_BACKEND "scalar"
+#endif
 
 #ifdef DEBUG
 #  define LOG(msg, ...) fprintf(stderr, "DEBUG: " msg "\n", ##__VA_ARGS__);
@@ -57,979 +91,7291 @@
 #define AMP_TO_DB(amp) (20 * log10(amp))
 #define DB_TO_AMP(dB) (pow(10, (dB / 20))
 
-// Generic-ish hehe
-#define DEFINE_QUEUE(prefix, item_type) \
-  typedef struct prefix ## Node { \
-    item_type             value; \
-    struct prefix ## Node *next; \
-  } prefix ## Node; \
-  typedef struct prefix ## Queue { \
-    prefix ## Node *head; \
-    prefix ## Node *tail; \
-  } prefix ## Queue;
-
-#define QUEUE_PUSH(queue, new_node) \
+// Single-producer/single-consumer lock-free ring buffer.
+// Used to pass values out of the JACK realtime thread: pushing never
+// allocates, never locks and never blocks. When the ring is full the value
+// is dropped and the overflow counter is incremented instead.
+// Capacity must be a power of two.
+#define DEFINE_RING(prefix, item_type) \
+  typedef struct prefix ## Ring { \
+    item_type             *items; \
+    size_t                mask; /* capacity - 1 */ \
+    atomic_size_t         head; /* next slot to read, owned by the consumer */ \
+    atomic_size_t         tail; /* next slot to write, owned by the producer */ \
+    atomic_uint           overflows; \
+  } prefix ## Ring;
+
+#define RING_INIT(ring, capacity) \
   { \
-    /* current last node (if there is one) now has pushed node going after it */ \
-    if (queue.tail != NULL) queue.tail->next = new_node; \
-    /* pushed node is the last item now */ \
-    queue.tail = new_node; \
-    /* first value in the queue is its head too */ \
-    if (queue.head == NULL) queue.head = new_node; \
+    ring.items = malloc(sizeof(*ring.items) * (capacity)); \
+    MALLOC_CHECK(ring.items); \
+    ring.mask = (capacity) - 1; \
+    atomic_init(&ring.head, 0); \
+    atomic_init(&ring.tail, 0); \
+    atomic_init(&ring.overflows, 0); \
   }
 
-// WARNING! It does not lock the mutex, only unlocks it!
-#define QUEUE_SHIFT(queue, queue_lock_to_release) \
+// Producer side. Evaluates to “false” if the ring is full.
+#define RING_PUSH(ring, new_value) \
+  ({ \
+    size_t tail = atomic_load_explicit(&ring.tail, memory_order_relaxed); \
+    size_t head = atomic_load_explicit(&ring.head, memory_order_acquire); \
+    bool pushed = tail - head <= ring.mask; \
+    \
+    if (pushed) { \
+      ring.items[tail & ring.mask] = (new_value); \
+      atomic_store_explicit(&ring.tail, tail + 1, memory_order_release); \
+    } else { \
+      atomic_fetch_add_explicit(&ring.overflows, 1, memory_order_relaxed); \
+    } \
+    \
+    pushed; \
+  })
+
+// Consumer side. Evaluates to “false” if the ring is empty.
+#define RING_SHIFT(ring, value_ptr) \
   ({ \
-    __auto_type value = queue.head->value; \
-    __auto_type tmp_node = queue.head; \
-    queue.head = queue.head->next; \
+    size_t head = atomic_load_explicit(&ring.head, memory_order_relaxed); \
+    size_t tail = atomic_load_explicit(&ring.tail, memory_order_acquire); \
+    bool shifted = head != tail; \
     \
-    /* end of the queue */ \
-    if (queue.head == NULL) queue.tail = NULL; \
+    if (shifted) { \
+      *(value_ptr) = ring.items[head & ring.mask]; \
+      atomic_store_explicit(&ring.head, head + 1, memory_order_release); \
+    } \
     \
-    pthread_mutex_unlock(&queue_lock_to_release); \
-    tmp_node->next = NULL; \
-    free(tmp_node); \
-    value; \
+    shifted; \
   })
 
+// Amount of values in the ring that are not shifted yet.
+#define RING_DEPTH(ring) \
+  ( atomic_load_explicit(&ring.tail, memory_order_acquire) \
+  - atomic_load_explicit(&ring.head, memory_order_acquire) )
+
+// Capacity of value rings between the JACK thread and the value consumers.
+// At the default RMS window size it is about 2 seconds of value updates.
+#define VALUE_RING_SIZE 1024
+
 char jack_client_name[] = "pidalboard-expression-pedal"; // TODO make customizable by command line args
 int socket_port = 31416; // TODO make customizable by command line args
 
 typedef jack_default_audio_sample_t sample_t; // shorter name
 typedef struct { sample_t rms_min_bound, rms_max_bound; } RmsBounds; // in dB
 
-DEFINE_QUEUE(Uint8,    uint8_t);
-DEFINE_QUEUE(Decibels, sample_t);
+typedef enum {
+  RMS_MODE_TUMBLING, // separate consecutive windows, a value per window
+  RMS_MODE_SLIDING,  // moving window, a value per hop
+} RmsMode;
+
+typedef enum {
+  DETECTOR_RMS,    // broadband RMS of the returned signal
+  DETECTOR_LOCKIN, // synchronous I/Q demodulation against the sent sine wave
+} DetectorType;
+
+// Response curve, maps the position that is linear in dB between the bounds
+// to the position that is reported (see “--curve”).
+typedef enum {
+  CURVE_LINEAR, // as is
+  CURVE_LOG,    // rises fast at the start and slowly at the end
+  CURVE_EXP,    // rises slowly at the start and fast at the end
+  CURVE_S,      // slowly at both ends (smoothstep)
+  CURVE_POINTS, // through the points recorded with --record-curve
+} CurveType;
+
+#define CURVE_MAX_POINTS 32
+
+// Recorded points of a response curve, sorted by position.
+typedef struct {
+  unsigned int        count;
+  sample_t            position[CURVE_MAX_POINTS]; // from 0 to 1
+  sample_t            rms_db[CURVE_MAX_POINTS];
+} CurvePoints;
 
-typedef struct Connection {
-  int                 socket_fd; // connection socket FD
-  pthread_mutex_t     queue_lock;
-  pthread_cond_t      queue_cond;
-  Uint8Queue          value_changes_queue;
-  struct Connection   *next;
-} Connection;
+typedef enum {
+  OSCILLATOR_SIN,       // “sin()” call for every sample (reference implementation)
+  OSCILLATOR_WAVETABLE, // precomputed single rotation of the sine wave
+  OSCILLATOR_RECURSIVE, // phase-rotating complex phasor
+} OscillatorType;
 
 typedef struct {
-  jack_nframes_t      sample_rate, buffer_size;
-
-  jack_client_t       *jack_client;
+  OscillatorType      type;
+
+  // For “OSCILLATOR_WAVETABLE”, “sine_wave_one_rotation_samples” long.
+  sample_t            *wavetable;
+
+  // For “OSCILLATOR_RECURSIVE”.
+  // The phasor is reset to (1, 0) at the beginning of every rotation,
+  // this keeps it in phase with the other backends and also prevents
+  // accumulation of the rounding errors (amplitude drift).
+  double              phasor_re, phasor_im;
+  double              rotation_re, rotation_im;
+} Oscillator;
+
+// Maximum amount of pedals handled by a single JACK client.
+#define MAX_CHANNELS 16
+_Static_assert(MAX_CHANNELS == EP_SHM_MAX_CHANNELS, "Shared memory slots");
+
+// A single expression pedal. A sine wave is sent to the pedal through
+// the send port and pedal position is detected from the signal that comes
+// back through the return port.
+typedef struct {
+  uint8_t             number; // starting from 1, used in port names and output
   jack_port_t         *send_port, *return_port;
+  jack_nframes_t      sample_rate; // copy of the JACK sample rate
 
   uint8_t             last_value;
+  uint16_t            last_value16;
 
-  bool                binary_output;
+  // Mean-square thresholds of the values (see “init_value_thresholds()”),
+  // “NULL” when the values are quantized from the dB level.
+  sample_t            *value_thresholds; // 2⁸ long
+  sample_t            *value16_thresholds; // 2¹⁶ long, when 16-bit is needed
 
-  pthread_mutex_t     queue_lock;
-  pthread_cond_t      queue_cond;
-  Uint8Queue          value_changes_queue;
-  DecibelsQueue       calibration_values_queue; // for calibration mode only
+  // Response curve compiled to a table by “init_curve()”,
+  // the table is “NULL” for the linear one.
+  CurveType           curve;
+  CurvePoints         curve_points; // for “CURVE_POINTS”
+  sample_t            *curve_table; // “CURVE_TABLE_SIZE” + 1 long
 
-  int                 server_socket_fd;    // for socket mode only
-  Connection          *socket_connections; // for socket mode only
-  pthread_mutex_t     connections_lock;    // for socket mode only
+  // MIDI CC output (see “MidiOutput”).
+  uint8_t             midi_cc; // controller number (MSB one for 14-bit)
+  uint16_t            last_midi_value; // “MIDI_VALUE_NONE” before the first one
+
+  // Control signal output (see “--cv”).
+  jack_port_t         *cv_port;
+  sample_t            *cv_buf; // buffer of “cv_port” for the current period
+  jack_nframes_t      cv_sample_i; // samples of “cv_buf” rendered so far
+  sample_t            cv_value, cv_target; // from 0 to 1
 
   sample_t            sine_wave_freq;
   jack_nframes_t      sine_wave_sample_i;
   jack_nframes_t      sine_wave_one_rotation_samples;
+  Oscillator          oscillator;
 
+  DetectorType        detector;
   RmsBounds           rms_bounds;
+  RmsMode             rms_mode;
   bool                use_default_rms_window_size;
   jack_nframes_t      rms_window_size;
+  // Position in the current window (tumbling mode)
+  // or in “rms_history” (sliding mode).
   jack_nframes_t      rms_window_sample_i;
   sample_t            rms_sum;
   sample_t            last_rms_db;
-} State;
-
-void* handle_value_updates(void *arg)
-{
-  State *state = (State *)arg;
-
-  int stdout_fd
-    = (state->binary_output && state->server_socket_fd != -1)
-    ? dup(fileno(stdout))
-    : -1;
-
-  for (;;) {
-    pthread_mutex_lock(&state->queue_lock);
-    LOG("Waiting for a notification of a new value update…");
-    pthread_cond_wait(&state->queue_cond, &state->queue_lock);
-    LOG("Received a notification of a change of the value.");
-
-    handle_next_queue_item_without_waiting:
-      if (state->value_changes_queue.head == NULL) {
-        pthread_mutex_unlock(&state->queue_lock);
-        LOG("Value changes queue is empty.");
-      } else {
-        uint8_t value =
-          QUEUE_SHIFT(state->value_changes_queue, state->queue_lock);
-
-        if (state->server_socket_fd != -1) {
-
-          LOG("Sending value update (%d) to client socket connections…", value);
-          pthread_mutex_lock(&state->connections_lock);
-          Connection *connection = state->socket_connections;
-
-          for (
-            int i = 1;
-            connection != NULL;
-            connection = connection->next, ++i
-          ) {
-            LOG(
-              "Sending value update (%d) to the client socket connection "
-              "handler thread #%d (FD: %d)…",
-              value,
-              i,
-              connection->socket_fd
-            );
-
-            Uint8Node *new_node = malloc(sizeof(Uint8Node));
-            MALLOC_CHECK(new_node);
-            new_node->value = value;
-            new_node->next = NULL;
-            pthread_mutex_lock(&connection->queue_lock);
-            QUEUE_PUSH(connection->value_changes_queue, new_node);
-            pthread_cond_signal(&connection->queue_cond);
-            pthread_mutex_unlock(&connection->queue_lock);
-          }
-
-          pthread_mutex_unlock(&state->connections_lock);
-
-        } else if (state->binary_output) {
-          if (write(stdout_fd, &value, sizeof(uint8_t)) == -1)
-            PERR("Failed to write binary data to stdout");
-        } else {
-          printf("%d\n", value);
-        }
-
-        // Don’t wait for a next notification yet,
-        // handle whole queue before starting to wait again.
-        pthread_mutex_lock(&state->queue_lock);
-        goto handle_next_queue_item_without_waiting;
-      }
-  }
-}
-
-void* handle_calibrate_value_updates(void *arg)
-{
-  State *state = (State *)arg;
-
-  for (;;) {
-    pthread_mutex_lock(&state->queue_lock);
-    LOG("Waiting for a notification of a new RMS dB value update…");
-    pthread_cond_wait(&state->queue_cond, &state->queue_lock);
-    LOG("Received a notification of a change of the RMS dB value.");
 
-    handle_next_queue_item_without_waiting:
-      if (state->calibration_values_queue.head == NULL) {
-        pthread_mutex_unlock(&state->queue_lock);
-        LOG("RMS dB value changes queue is empty.");
-      } else {
-        sample_t rms_db =
-          QUEUE_SHIFT(state->calibration_values_queue, state->queue_lock);
+  // Quantization hysteresis in 8-bit value steps, 0 to turn it off
+  // (see “is_held_by_hysteresis()”).
+  sample_t            hysteresis;
+
+  // One-Euro filter of the dB values (see “filter_one_euro()”),
+  // “one_euro_min_cutoff” is 0 when it is turned off.
+  sample_t            one_euro_min_cutoff; // in Hz
+  sample_t            one_euro_beta; // cutoff growth in Hz per dB/s
+  bool                one_euro_primed; // got the first value
+  sample_t            one_euro_value, one_euro_slope; // dB and dB/s
+  jack_nframes_t      one_euro_frame_time; // of the last value
+
+  // For sliding RMS mode only.
+  // “rms_history” holds last “rms_window_size” samples (circular buffer).
+  sample_t            *rms_history;
+  bool                use_default_rms_hop_size;
+  jack_nframes_t      rms_hop_size;
+  jack_nframes_t      rms_hop_sample_i;
+
+  // For lock-in detector only (“rms_window_size” is the integration length).
+  // Reference sine and cosine waves, one rotation long, indexed by
+  // the same position as the sent sine wave (“sine_wave_sample_i”).
+  sample_t            *lockin_sin, *lockin_cos;
+  sample_t            lockin_i_sum, lockin_q_sum;
+} Channel;
+
+// New configuration of a channel (see --control) prepared by the control
+// thread and adopted by the realtime thread (see “adopt_channel_reloads()”).
+// The realtime thread swaps the tables of the channel with the ones in
+// the block and hands the block back, the control thread frees it.
+typedef struct {
+  Channel             channel;
+  // The sine wave and the window are the same, the signal processing goes
+  // on uninterrupted, only the bounds (and what depends on them) change.
+  bool                keep_signal;
+} ChannelReload;
 
-        fprintf(stderr, "New RMS: %f dB\n", rms_db);
+// Control channel state (see --control), used by the control thread only.
+typedef struct {
+  char                *path; // of the Unix socket
+  int                 socket_fd;
+  pthread_t           tid;
+  // Current configuration of the channels, without any tables
+  // (see “reload_channel()”).
+  Channel             channels[MAX_CHANNELS];
+} Control;
+
+// Several channels multiplexed on a single send/return port pair
+// (frequency-division multiplexing, see --tones-per-port).
+// The sine waves of the channels are mixed into the send port and the tones
+// are separated from the returned signal by a bank of Goertzel filters
+// (with Hann window to suppress leakage between the tones).
+// The per-tone state is laid out as struct-of-arrays so the inner loop over
+// the tones of the filter bank is cache-friendly and vectorizable.
+typedef struct {
+  unsigned int        first_channel; // index of the first channel in the group
+  unsigned int        tones_count;
+  jack_port_t         *send_port, *return_port;
 
-        // Don’t wait for a next notification yet,
-        // handle whole queue before starting to wait again.
-        pthread_mutex_lock(&state->queue_lock);
-        goto handle_next_queue_item_without_waiting;
-      }
-  }
-}
+  // The integration window is shared by all the tones of the group,
+  // see “init_tone_group()”.
+  jack_nframes_t      window_size;
+  jack_nframes_t      window_sample_i;
+  sample_t            *window; // Hann window, “window_size” long
+  sample_t            window_sum;
 
-// Waits for a connection, and when receives one spawns a new thread which will
-// wait for another connection whilst in current thread it will receive value
-// updates and send those values to the connected client.
-void* socket_client_handle(void *arg)
-{
-  LOG("Running a new socket connection thread…");
-  State *state = (State *)arg;
+  sample_t            coeff[MAX_CHANNELS]; // 2·cos(ω) of every tone
+  sample_t            s1[MAX_CHANNELS], s2[MAX_CHANNELS];
+} ToneGroup;
 
-  struct sockaddr_in client_address;
-  memset(&client_address, 0, sizeof(client_address));
-  socklen_t client_address_length = sizeof(client_address);
+typedef struct {
+  uint8_t             channel; // channel number (starting from 1)
+  uint8_t             value; // 8-bit value
+  // “value” differs from the previous 8-bit value of the channel.
+  // Value updates are also made when only “value16” changes, 8-bit output
+  // formats skip those (see “is_value_update_visible()”).
+  bool                value_changed;
+  uint16_t            value16; // 16-bit value
+  // Unquantized value, from 0 to 1.
+  // Only set when “high_resolution” is on (no 8-bit format carries it).
+  float               position;
+  jack_nframes_t      frame_time; // JACK frame time of the detected value
+} ValueUpdate;
 
-  LOG("Waiting for a new client socket connection…");
+typedef struct {
+  uint8_t             channel; // channel number (starting from 1)
+  sample_t            rms_db;
+} DecibelsUpdate;
+
+// Statistics of the dB levels of a channel in calibration mode. Collected
+// in blocks of “CALIBRATION_BLOCK_MS” by the realtime thread
+// (see “update_calibration_stats()”), read by the automatic calibration
+// session (see “auto_calibrate()”).
+typedef struct {
+  // Used by the realtime thread only
+  bool                is_started;
+  jack_nframes_t      block_start; // frame time
+  unsigned int        count;
+  double              sum, sum_of_squares; // of the levels in the block
+
+  // Published at the end of every block (relaxed, the mean and the variance
+  // may come from adjacent blocks, it does not matter for the statistics).
+  _Atomic sample_t    block_mean, block_variance; // in dB and dB²
+  _Atomic sample_t    min, max; // over the whole session, in dB
+} CalibrationStats;
+
+// Output format of value updates for stdout or a socket client
+// (see “--format”).
+typedef enum {
+  OUTPUT_FORMAT_TEXT,       // human-readable lines with 8-bit values
+  OUTPUT_FORMAT_BINARY,     // raw 8-bit values
+  OUTPUT_FORMAT_FRAMED_U16, // frames with 16-bit values
+  OUTPUT_FORMAT_FRAMED_F32, // frames with float32 values
+} OutputFormat;
+
+// Framed binary protocol (“u16” and “f32” output formats), a frame per
+// value update (integers are big-endian):
+//   0  uint8   sync byte (“FRAME_SYNC”), helps to find frame boundaries
+//   1  uint8   protocol version (“FRAME_VERSION”)
+//   2  uint8   value type (“FRAME_VALUE_U16” or “FRAME_VALUE_F32”),
+//              it also tells the size of the frame
+//   3  uint8   channel number (starting from 1)
+//   4  uint32  JACK frame time of the sample the value was detected at
+//   8  uint16  value in range from 0 to 65535 (10 bytes frame)
+//      or
+//   8  float32 value in range from 0.0 to 1.0 (IEEE 754, 12 bytes frame)
+//
+// A client that is not admitted (see --max-clients) gets an error frame
+// right before the connection is closed:
+//   0  uint8   sync byte (“FRAME_SYNC”)
+//   1  uint8   protocol version (“FRAME_VERSION”)
+//   2  uint8   “FRAME_ERROR” (4 bytes frame)
+//   3  uint8   error code (“FRAME_ERROR_TOO_MANY_CLIENTS”)
+#define FRAME_SYNC      0xA5
+#define FRAME_VERSION   1
+#define FRAME_VALUE_U16 1
+#define FRAME_VALUE_F32 2
+#define FRAME_ERROR     3
+
+#define FRAME_ERROR_TOO_MANY_CLIENTS 1
+
+// Max size of a formatted value update (see “format_value_update()”),
+// enough for “255 255\n” text line (with a terminating null) and for a frame.
+#define VALUE_UPDATE_MAX_SIZE 16
+
+DEFINE_RING(ValueUpdate,    ValueUpdate);
+DEFINE_RING(DecibelsUpdate, DecibelsUpdate);
+
+// MIDI Control Change output on a JACK MIDI port (see “--midi-cc”).
+typedef struct {
+  bool                enabled;
+  uint8_t             channel; // MIDI channel, from 0 to 15
+  // 14-bit values: MSB on the controller number of the pedal and LSB on
+  // the controller number + 32 (only controllers from 0 to 31 have pairs).
+  bool                fine;
+} MidiOutput;
 
-  int client_socket_fd = accept(
-    state->server_socket_fd,
-    (struct sockaddr *)&client_address,
-    &client_address_length
-  );
+#define MIDI_CONTROL_CHANGE 0xB0
+#define MIDI_CC_LSB_OFFSET  32
+#define MIDI_VALUE_NONE     UINT16_MAX // never a 7-bit or a 14-bit value
 
-  if (client_socket_fd < 0) PERR("Failed to accept socket client connection");
+typedef struct {
+  jack_nframes_t      offset; // frame offset in the period
+  jack_midi_data_t    data[3];
+} MidiEvent;
+
+// Max amount of MIDI events written during a single period, the rest are
+// dropped. It is more than a MIDI cable could pass anyway.
+#define MIDI_EVENTS_MAX 256
+
+// Default time constant (in ms) of the control signal smoothing filter
+// (see “--cv-smoothing”). A few update intervals of the default detector
+// (a value per rotation of 440 Hz sine wave, ≈2.3 ms).
+#define CV_DEFAULT_SMOOTHING_MS 5.0f
+
+// How value updates are kept for a socket client until they are sent
+// (see “--delivery”).
+typedef enum {
+  DELIVERY_FULL,    // every value update (up to a cap), the queue grows
+  DELIVERY_BOUNDED, // up to “bound” value updates, the oldest are dropped
+  DELIVERY_LATEST,  // only the latest value of every channel
+} DeliveryMode;
 
-  fprintf(
-    stderr,
-    "Received a socket connection from “%s” client (client socket FD: %d).\n",
-    inet_ntoa(client_address.sin_addr),
-    client_socket_fd
-  );
+typedef struct {
+  DeliveryMode        mode;
+  size_t              bound; // for “DELIVERY_BOUNDED” only
+} DeliveryPolicy;
 
-  Connection *this_connection = malloc(sizeof(Connection));
-  MALLOC_CHECK(this_connection);
-  memset(this_connection, 0, sizeof(Connection));
-  this_connection->socket_fd = client_socket_fd;
-  if (pthread_mutex_init(&this_connection->queue_lock, NULL) != 0)
-    ERR("pthread_mutex_init() error!");
-  if (pthread_cond_init(&this_connection->queue_cond, NULL) != 0)
-    ERR("pthread_cond_init() error!");
-  this_connection->value_changes_queue.head = NULL;
-  this_connection->value_changes_queue.tail = NULL;
-  this_connection->next = NULL;
+#define DEFAULT_DELIVERY_POLICY ((DeliveryPolicy) { DELIVERY_BOUNDED, 1024 })
 
-  LOG(
-    "Appending connection entity (socket FD: %d) to the socket connections list…",
-    client_socket_fd
-  );
+// Realtime hardening of the process (see --lock-memory, --consumer-priority
+// and --pin-cpus). The JACK thread is left as JACK sets it up.
+typedef struct {
+  bool                lock_memory; // prefault and lock all the memory
+  // “SCHED_FIFO” priority of the value consumer thread, 0 to keep
+  // the default scheduling. Always lower than the one of the JACK thread.
+  int                 consumer_priority;
+  bool                pin; // pin the threads other than the JACK one
+  cpu_set_t           cpus; // for “pin” only
+} RealtimeSetup;
+
+// Heap that is faulted in and kept by malloc with --lock-memory, so that
+// the allocations of the consumers (grown queues of the socket clients
+// and such) do not fault pages in later.
+#define PREFAULT_HEAP_SIZE (4 * 1024 * 1024)
+
+// Min capacity of the value updates queue preallocated for every socket
+// connection (see “init_socket_server()”), it is the bound of the default
+// delivery policy when it is larger. It is also the initial capacity
+// of the queue of “full” delivery policy.
+#define FULL_DELIVERY_QUEUE_CAPACITY 64
+
+// Max capacity of the value updates queue of “full” delivery policy
+// (1 MiB of value updates), the oldest ones are dropped beyond it.
+#define FULL_DELIVERY_QUEUE_MAX_CAPACITY 65536
+
+// Size of the buffer of formatted value updates that are being sent.
+// It is filled from the pending value updates only when it is empty, so with
+// “latest” delivery policy the client does not wait behind stale values.
+#define CONNECTION_BUFFER_SIZE 256
+
+// Max amount of value updates in the buffer of a connection, their frame times
+// are kept until they are written (see “record_delivery_latency()”).
+#define CONNECTION_BUFFER_UPDATES 64
+
+// Max length of a command line received from a socket client.
+#define CONNECTION_INPUT_SIZE 64
+
+// Size of the pool of socket client connections (see --max-clients).
+#define DEFAULT_MAX_CLIENTS 16
+#define MAX_MAX_CLIENTS     1024
+
+// Accepting new connections is paused for a while when the pool is full
+// or when accepting fails (for instance when there are no FDs left),
+// the pause is doubled every time up to the max one.
+#define ACCEPT_BACKOFF_MIN_MS 10
+#define ACCEPT_BACKOFF_MAX_MS 1000
 
-  pthread_mutex_lock(&state->connections_lock);
+typedef struct Connection {
+  int                 socket_fd; // connection socket FD (non-blocking)
+  DeliveryPolicy      policy;
+  OutputFormat        format;
+
+  // Pending value updates for “full” and “bounded” delivery policies.
+  // Ring buffer, it is the preallocated “slot” unless it grows for “full”
+  // delivery policy.
+  ValueUpdate         *queue;
+  size_t              queue_capacity, queue_head, queue_size;
+  ValueUpdate         *slot; // see “init_socket_server()”
+  size_t              slot_capacity;
+
+  // Pending latest values of the channels for “latest” delivery policy.
+  // Sequence number tells the order in which they came, 0 if the slot is
+  // empty.
+  ValueUpdate         latest[MAX_CHANNELS];
+  unsigned long long  latest_seq[MAX_CHANNELS];
+  unsigned long long  seq; // sequence number of the last value update
+
+  char                buffer[CONNECTION_BUFFER_SIZE]; // formatted, not sent yet
+  size_t              buffer_offset, buffer_size; // pending part of “buffer”
+  // Frame times of the value updates in “buffer” and where they end in it,
+  // the first “buffer_written” of them are written already.
+  jack_nframes_t      buffer_frame_times[CONNECTION_BUFFER_UPDATES];
+  size_t              buffer_ends[CONNECTION_BUFFER_UPDATES];
+  size_t              buffer_updates, buffer_written;
+  char                input[CONNECTION_INPUT_SIZE]; // incomplete command line
+  size_t              input_size;
+  bool                waiting_writable; // subscribed to “EPOLLOUT”
+
+  // Counters, reported when the connection is closed.
+  unsigned long long  sent;      // value updates written to the socket
+  unsigned long long  dropped;   // value updates that did not fit the queue
+  unsigned long long  coalesced; // value updates replaced by a newer value
+
+  // Neighbours in the list of the connections, an unused connection of
+  // the pool is in the list of the free ones (linked by “next” only).
+  struct Connection   *prev, *next;
+} Connection;
 
-  {
-    Connection *current_connection = state->socket_connections;
-    if (current_connection == NULL)
-      state->socket_connections = this_connection;
-    else {
-      while (current_connection->next != NULL)
-        current_connection = current_connection->next;
-      current_connection->next = this_connection;
-    }
-  }
+// Realtime instrumentation (see “--stats”). Written by the JACK threads with
+// relaxed atomics only (no locks, no allocations, no syscalls), read by
+// the stats reporter thread (see “report_stats_loop()”).
+// Time spent in the process callback is put into buckets of 10% of
+// the period, the last bucket is for the callbacks that took longer than
+// the period.
+#define RT_STATS_LOAD_BUCKETS 11
 
-  pthread_mutex_unlock(&state->connections_lock);
-  LOG("Spawning another thread to wait for another client socket connection…");
+// Delivery latency, from the frame time stamp of a value (the last sample
+// of the detection window) to the moment it is written to stdout, a socket
+// or a UDP datagram. Power of two buckets in microseconds, the last one
+// is for everything longer.
+#define DELIVERY_LATENCY_BUCKETS 24
 
-  {
-    pthread_t tid = -1;
-    int err = pthread_create(&tid, NULL, &socket_client_handle, (void *)state);
-    if (err != 0) ERR("Failed to create a thread: [%s]", strerror(err));
+typedef struct {
+  atomic_ullong       callbacks;
+  atomic_ullong       busy_ns; // total time spent in the process callback
+  atomic_ullong       period_ns; // total duration of the periods
+  atomic_ullong       max_ns; // since the last report
+  atomic_ullong       load_histogram[RT_STATS_LOAD_BUCKETS];
+  atomic_uint         xruns;
+  atomic_size_t       max_ring_depth; // since the last report
+  atomic_uint         midi_dropped;
+  atomic_ullong       suppressed; // value updates held by the hysteresis
+
+  // Written by the value consumers (see “record_delivery_latency()”).
+  atomic_ullong       delivery_latency[DELIVERY_LATENCY_BUCKETS];
+  atomic_ullong       max_delivery_latency_us; // since the last report
+} RtStats;
 
-    LOG(
-      "Spawned another thread for handling client socket connection (thread id: %ld).",
-      tid
-    );
-  }
+typedef struct {
+  jack_nframes_t      sample_rate, buffer_size;
 
-  for (;;) {
-    pthread_mutex_lock(&this_connection->queue_lock);
+  jack_client_t       *jack_client;
+  jack_nframes_t      period_frame_time; // of the current period (JACK thread)
+
+  Channel             channels[MAX_CHANNELS];
+  unsigned int        channels_count;
+
+  // For frequency-division multiplexing only (“tones_per_port” > 1).
+  unsigned int        tones_per_port;
+  ToneGroup           tone_groups[MAX_CHANNELS];
+  unsigned int        tone_groups_count;
+  sample_t            *mix_buf; // “buffer_size” long, to mix the tones
+
+  OutputFormat        output_format; // for stdout, default one for socket clients
+  // Make value updates also when only the 16-bit value changes. Only when
+  // some output can use it, otherwise it is just extra traffic.
+  bool                high_resolution;
+
+  // Written by the JACK thread after pushing to one of the rings.
+  // Writing to an eventfd is a single syscall which never blocks (the counter
+  // can not realistically overflow) and is async-signal-safe, so it is fine
+  // to do from the realtime thread. Unlike a semaphore it can be watched by
+  // epoll together with the sockets (see “socket_server_loop()”).
+  int                 values_event_fd;
+  ValueUpdateRing     value_changes_ring;
+  DecibelsUpdateRing  calibration_values_ring; // for calibration mode only
+  // The last dB level of every channel in calibration mode
+  // (see “record_curve()”), NaN before the first one.
+  _Atomic sample_t    calibration_levels[MAX_CHANNELS];
+  // Automatic calibration session (see --auto-calibrate), the levels are
+  // not queued then, only the statistics are kept.
+  bool                auto_calibration;
+  CalibrationStats    calibration_stats[MAX_CHANNELS];
 
-    LOG(
-      "Waiting for a notification of a new value update "
-      "for client socket connection (FD: %d)…",
-      client_socket_fd
-    );
+  int                 server_socket_fd;    // for socket mode only
+  Connection          *socket_connections; // for socket mode only
+  int                 epoll_fd;            // for socket mode only
+  DeliveryPolicy      delivery_policy;     // for socket mode only, default one
+  // Connections are taken from the pool allocated once at startup
+  // (see “init_socket_server()”), “max_clients” long.
+  unsigned int        max_clients;         // for socket mode only
+  Connection          *connection_pool;    // for socket mode only
+  // Value updates queues of the connections, “max_clients” slots,
+  // “queue_slot_capacity” long each.
+  ValueUpdate         *queue_pool;         // for socket mode only
+  size_t              queue_slot_capacity; // for socket mode only
+  Connection          *free_connections;   // for socket mode only
+  // Pause of accepting new connections (see “ACCEPT_BACKOFF_MIN_MS”),
+  // 0 when they are accepted.
+  unsigned int        accept_backoff_ms;   // for socket mode only
+  long long           accept_resume_ms;    // for socket mode only
+
+  int                 udp_socket_fd;       // for UDP mode only
+  struct sockaddr_in  udp_address;         // for UDP mode only, destination
+  uint32_t            udp_sequence;        // for UDP mode only, last datagram
+
+  MidiOutput          midi;
+  jack_port_t         *midi_port; // for MIDI output only
+  // Events of the current period (JACK thread). The channels are processed
+  // one after another, so the events are collected first and written
+  // to the port ordered by frame offset (see “write_midi_events()”).
+  MidiEvent           midi_events[MIDI_EVENTS_MAX];
+  unsigned int        midi_events_count;
+
+  bool                cv_output;
+  sample_t            cv_smoothing; // time constant in seconds
+  sample_t            cv_coeff; // of the one-pole filter, for the sample rate
+
+  unsigned int        stats_interval; // in seconds, 0 if turned off
+  RtStats             stats;
+  // Monotonic clock time in µs of frame 0 when there is no JACK client
+  // (see “--latency-test”).
+  long long           frames_epoch_us;
+  // There is no shutdown pipe without JACK, the value consumer is stopped
+  // by this flag and a notification through the eventfd instead
+  // (see “run_latency_test_path()”).
+  atomic_bool         is_stopping;
+
+  // Runtime reconfiguration (see --control), “NULL” when it is off.
+  // A new configuration of a channel goes to the realtime thread through
+  // “pending_reloads”, the replaced one comes back through “retired_reloads”.
+  Control             *control;
+  _Atomic(ChannelReload *) pending_reloads[MAX_CHANNELS];
+  _Atomic(ChannelReload *) retired_reloads[MAX_CHANNELS];
+
+  // The process callbacks skip the periods while the tables are rebuilt
+  // for a new sample rate or buffer size (see “pause_processing()”).
+  atomic_bool         is_paused;
+  atomic_bool         is_processing; // by the realtime thread right now
+
+  // Latest values for the readers on the same host (see --shm),
+  // written by the realtime thread, “NULL” when it is off.
+  EpShm               *shm;
+  char                *shm_name;
+
+  RealtimeSetup       realtime;
+  int                 jack_priority; // of the JACK thread, -1 if it is not RT
+
+  // Threads that are joined on shutdown (see “terminate_app()”).
+  pthread_t           consumer_tid;
+  pthread_t           stats_tid;   // if “stats_interval” is not 0
+  bool                has_session; // see “run_calibration_session()”
+  pthread_t           session_tid; // if “has_session”
+} State;
 
-    pthread_cond_wait(
-      &this_connection->queue_cond,
-      &this_connection->queue_lock
-    );
+// Prints a warning when the JACK thread had to drop some values
+// because the ring was full.
+void report_ring_overflows(atomic_uint *overflows, unsigned int *reported)
+{
+  unsigned int current = atomic_load_explicit(overflows, memory_order_relaxed);
 
-    LOG(
-      "Received a notification of a change of the value "
-      "for client socket connection (FD: %d)…",
-      client_socket_fd
+  if (current != *reported) {
+    fprintf(
+      stderr,
+      "WARNING: Value consumer is too slow, %u value update(s) dropped "
+      "(%u in total)!\n",
+      current - *reported,
+      current
     );
 
-    handle_next_queue_item_without_waiting:
-      if (this_connection->value_changes_queue.head == NULL) {
-        pthread_mutex_unlock(&this_connection->queue_lock);
-
-        LOG(
-          "Value changes queue is empty "
-          "for client socket connection (FD: %d).",
-          client_socket_fd
-        );
-      } else {
-        uint8_t value = QUEUE_SHIFT(
-          this_connection->value_changes_queue,
-          this_connection->queue_lock
-        );
-
-        if (state->binary_output) {
-          LOG(
-            "Sending value update (%d) directly to client socket connection "
-            "as 8-bit binary unsigned integer (in range from 0 to %d, FD %d)…",
-            value,
-            UINT8_MAX,
-            client_socket_fd
-          );
-        } else {
-          LOG(
-            "Sending value update (%d) directly to client socket connection "
-            "as a line with human-readable text with the number (FD %d)…",
-            value,
-            client_socket_fd
-          );
-        }
-
-        ssize_t write_result = 0;
-
-        if (state->binary_output)
-          write_result = write(client_socket_fd, &value, sizeof(uint8_t));
-        else {
-          char str[sizeof("255\n")];
-          sprintf(str, "%u\n", value);
-          write_result = write(client_socket_fd, str, strlen(str));
-        }
-
-        if (write_result == -1) {
-          fprintf(
-            stderr,
-            "Failed to write to client socket connection "
-            "(client socket FD: %d), taking it as lost connection…\n",
-            client_socket_fd
-          );
-
-          LOG(
-            "Removing the connection from the connections list "
-            "and closing client socket connection (FD: %d) …",
-            client_socket_fd
-          );
-
-          pthread_mutex_lock(&state->connections_lock);
-          Connection *connection = state->socket_connections;
-
-          if (connection == this_connection) {
-            state->socket_connections = connection->next;
-          } else {
-            for (;; connection = connection->next) {
-              if (connection->next == NULL) ERR(
-                "Unexpectedly reached end of client socket connections list "
-                "when trying to remove client socket connection from the list "
-                "(FD: %d)!",
-                client_socket_fd
-              );
-
-              if (connection->next == this_connection) {
-                connection->next = connection->next->next;
-                connection = NULL;
-                break;
-              }
-            }
-          }
-
-          pthread_mutex_unlock(&state->connections_lock);
-
-          LOG(
-            "Removed client socket connection from the client socket "
-            "connections list. Freeing memory and closing the client socket "
-            "connection (just in case, FD: %d)…",
-            client_socket_fd
-          );
-
-          this_connection->next = NULL;
-          free(this_connection);
-
-          if (close(client_socket_fd) < 0) PERR(
-            "Failed to close client socket connection (FD: %d)",
-            client_socket_fd
-          );
-
-          LOG(
-            "The client socket connection (FD: %d) handler thread is done.",
-            client_socket_fd
-          );
-
-          return NULL; // end of the thread
-        } else {
-          // Don’t wait for a next notification yet,
-          // handle whole queue before starting to wait again.
-          pthread_mutex_lock(&this_connection->queue_lock);
-          goto handle_next_queue_item_without_waiting;
-        }
-      }
+    *reported = current;
   }
-
-  return NULL;
 }
 
-inline sample_t sample_radians
-( sample_t       hz
-, jack_nframes_t sample_n
-, jack_nframes_t sample_rate
-)
+// Parses “text”, “binary”, “u16” or “f32”.
+// Returns “false” if the string is not a valid output format.
+bool parse_output_format(const char *str, OutputFormat *format)
 {
-  return (sample_t)sample_n * hz * 2 * M_PI / (sample_t)sample_rate;
+  if (EQ(str, "text")) *format = OUTPUT_FORMAT_TEXT;
+  else if (EQ(str, "binary")) *format = OUTPUT_FORMAT_BINARY;
+  else if (EQ(str, "u16")) *format = OUTPUT_FORMAT_FRAMED_U16;
+  else if (EQ(str, "f32")) *format = OUTPUT_FORMAT_FRAMED_F32;
+  else return false;
+  return true;
 }
 
-// Should return “uint32_t” but in calculations everywhere “int64_t” is used.
-inline sample_t finalize_rms_db(jack_nframes_t window_size, sample_t sum)
+// 8-bit output formats only show the value updates that change the 8-bit
+// value, so they get exactly the same stream as before 16-bit values
+// were added.
+static inline bool is_value_update_visible(OutputFormat format, ValueUpdate update)
 {
-  return AMP_TO_DB(1.0f / (sample_t)window_size * sum);
+  return update.value_changed
+    || format == OUTPUT_FORMAT_FRAMED_U16
+    || format == OUTPUT_FORMAT_FRAMED_F32;
 }
 
-int jack_process(jack_nframes_t nframes, void *arg)
+// Formats a value update for stdout or a socket client.
+// For 8-bit formats with a single channel it is just the value (as it always
+// was), with multiple channels the channel number goes first (“CHANNEL VALUE”
+// line or two bytes in binary format). Frames always have the channel number.
+// Returns the size of the formatted data.
+size_t format_value_update
+( State          *state
+, OutputFormat   format
+, ValueUpdate    update
+, char           *buf
+)
 {
-  State    *state      = (State *)arg;
-  sample_t *send_buf   = jack_port_get_buffer(state->send_port,   nframes);
-  sample_t *return_buf = jack_port_get_buffer(state->return_port, nframes);
-
-  for (
-    jack_nframes_t i = 0;
-    i < nframes;
-    ++i,
-    state->sine_wave_sample_i
-      = (state->sine_wave_sample_i + 1)
-      % state->sine_wave_one_rotation_samples
-  ) {
-    send_buf[i] = sin(sample_radians(
-      state->sine_wave_freq,
-      state->sine_wave_sample_i,
-      state->sample_rate
-    ));
-
-    if (++state->rms_window_sample_i >= state->rms_window_size) {
-      sample_t rms_db = finalize_rms_db(state->rms_window_size, state->rms_sum);
-
-      if (rms_db != state->last_rms_db) {
-        state->last_rms_db = rms_db;
-
-        uint8_t value = MIN(MAX(round(
-          (rms_db - state->rms_bounds.rms_min_bound)
-            * UINT8_MAX / state->rms_bounds.rms_max_bound
-        ), 0), UINT8_MAX);
-
-        if (value != state->last_value) {
-          Uint8Node *new_node = malloc(sizeof(Uint8Node));
-          MALLOC_CHECK(new_node);
-          new_node->value = value;
-          new_node->next = NULL;
-          pthread_mutex_lock(&state->queue_lock);
-          QUEUE_PUSH(state->value_changes_queue, new_node);
-          pthread_cond_signal(&state->queue_cond);
-          pthread_mutex_unlock(&state->queue_lock);
-          state->last_value = value;
-        }
+  bool multichannel = state->channels_count > 1;
+
+  switch (format) {
+    case OUTPUT_FORMAT_TEXT:
+      return multichannel
+        ? sprintf(buf, "%u %u\n", update.channel, update.value)
+        : sprintf(buf, "%u\n", update.value);
+
+    case OUTPUT_FORMAT_BINARY:
+      if (multichannel) *buf++ = update.channel;
+      *buf = update.value;
+      return multichannel ? 2 : 1;
+
+    case OUTPUT_FORMAT_FRAMED_U16:
+    case OUTPUT_FORMAT_FRAMED_F32: {
+      bool is_u16 = format == OUTPUT_FORMAT_FRAMED_U16;
+      uint32_t frame_time = htonl(update.frame_time);
+      buf[0] = (char)FRAME_SYNC;
+      buf[1] = FRAME_VERSION;
+      buf[2] = is_u16 ? FRAME_VALUE_U16 : FRAME_VALUE_F32;
+      buf[3] = update.channel;
+      memcpy(buf + 4, &frame_time, sizeof(uint32_t));
+
+      if (is_u16) {
+        uint16_t value = htons(update.value16);
+        memcpy(buf + 8, &value, sizeof(uint16_t));
+        return 10;
+      } else {
+        uint32_t value;
+        memcpy(&value, &update.position, sizeof(uint32_t));
+        value = htonl(value);
+        memcpy(buf + 8, &value, sizeof(uint32_t));
+        return 12;
       }
-
-      state->rms_window_sample_i = 0;
-      state->rms_sum = powf(return_buf[i], 2);
-    } else {
-      state->rms_sum += powf(return_buf[i], 2);
     }
   }
 
   return 0;
 }
 
-int jack_process_calibrate(jack_nframes_t nframes, void *arg)
+// Shutdown of the app is requested by the signal handlers and by JACK
+// (see “request_shutdown()”) and carried out by the main thread
+// (see “terminate_app()”). The request is a byte written to the pipe, it is
+// never read back, so the pipe stays readable and every thread watches it
+// to stop on its own.
+typedef struct {
+  int                 pipe[2]; // “-1” without JACK (see --latency-test)
+  volatile sig_atomic_t is_requested;
+  atomic_bool         jack_is_down;
+} ShutdownRequest;
+
+ShutdownRequest shutdown_request = { { -1, -1 }, 0, false };
+
+void init_shutdown_request()
 {
-  State    *state      = (State *)arg;
-  sample_t *send_buf   = jack_port_get_buffer(state->send_port,   nframes);
-  sample_t *return_buf = jack_port_get_buffer(state->return_port, nframes);
-
-  for (
-    jack_nframes_t i = 0;
-    i < nframes;
-    ++i,
-    state->sine_wave_sample_i
-      = (state->sine_wave_sample_i + 1)
-      % state->sine_wave_one_rotation_samples
-  ) {
-    send_buf[i] = sin(sample_radians(
-      state->sine_wave_freq,
-      state->sine_wave_sample_i,
-      state->sample_rate
-    ));
+  if (pipe2(shutdown_request.pipe, O_CLOEXEC | O_NONBLOCK) != 0)
+    PERR("Failed to create shutdown pipe");
+}
 
-    if (++state->rms_window_sample_i >= state->rms_window_size) {
-      sample_t rms_db = finalize_rms_db(state->rms_window_size, state->rms_sum);
+// Async-signal-safe, it is called from the signal handlers.
+void request_shutdown(bool jack_is_down)
+{
+  int saved_errno = errno;
+  if (jack_is_down) atomic_store(&shutdown_request.jack_is_down, true);
+  shutdown_request.is_requested = 1;
+
+  // When the pipe is full it is readable anyway
+  ssize_t written = write(shutdown_request.pipe[1], "", 1);
+  (void)written;
+  errno = saved_errno;
+}
 
-      if (rms_db != state->last_rms_db) {
-        DecibelsNode *new_node = malloc(sizeof(DecibelsNode));
-        MALLOC_CHECK(new_node);
-        new_node->value = rms_db;
-        new_node->next = NULL;
-        pthread_mutex_lock(&state->queue_lock);
-        QUEUE_PUSH(state->calibration_values_queue, new_node);
-        pthread_cond_signal(&state->queue_cond);
-        pthread_mutex_unlock(&state->queue_lock);
-        state->last_rms_db = rms_db;
-      }
+// Waits up to “timeout_ms” (forever if negative) for “fd” (unless it is -1)
+// to become readable. Returns “true” (at once if it is already so) when
+// the shutdown is requested.
+bool wait_for_shutdown(int fd, int timeout_ms)
+{
+  struct pollfd fds[2] = {
+    { .fd = shutdown_request.pipe[0], .events = POLLIN },
+    { .fd = fd,                       .events = POLLIN },
+  };
 
-      state->rms_window_sample_i = 0;
-      state->rms_sum = powf(return_buf[i], 2);
-    } else {
-      state->rms_sum += powf(return_buf[i], 2);
-    }
+  for (;;) {
+    if (poll(fds, 2, timeout_ms) >= 0) return (fds[0].revents & POLLIN) != 0;
+    if (errno != EINTR) PERR("poll() error");
   }
+}
 
-  return 0;
+// Wakes up the readers blocked in “ep_shm_wait()” after the JACK thread has
+// published new values (see “publish_shm_value()”). Only made when there are
+// any, the JACK thread increments the generation before it notifies
+// the consumer, so a reader that registers later sees the new generation.
+static void wake_shm_readers(EpShm *shm)
+{
+  if (atomic_load_explicit(&shm->waiters, memory_order_seq_cst) > 0)
+    syscall(SYS_futex, &shm->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
 }
 
-void register_ports(State *state)
+// Blocks until the JACK thread notifies about new values in one of the rings.
+// Returns “false” when the shutdown is requested instead (or the consumer
+// is stopped, see “is_stopping”), the values that are left in the rings
+// are still there.
+bool wait_for_values(State *state)
 {
-  LOG("Registering JACK send port…");
+  if (wait_for_shutdown(state->values_event_fd, -1)) return false;
+  eventfd_t count;
 
-  state->send_port = jack_port_register( state->jack_client
-                                       , "send"
-                                       , JACK_DEFAULT_AUDIO_TYPE
-                                       , JackPortIsOutput
-                                       , 0
-                                       );
+  while (eventfd_read(state->values_event_fd, &count) != 0)
+    if (errno != EINTR) PERR("Failed to read from the eventfd");
 
-  if (state->send_port == NULL) ERRJACK("Registering send port failed!");
+  // The JACK thread makes no system calls, so the shared memory readers
+  // are woken up by the consumer it has just notified.
+  if (state->shm != NULL) wake_shm_readers(state->shm);
+  return ! atomic_load(&state->is_stopping);
+}
 
-  LOG("Send JACK port is registered.");
-  LOG("Registering JACK return port…");
+// Relaxed maximum, for a single writer (the reporter only resets it).
+#define ATOMIC_STORE_MAX(atomic, value) \
+  ({ \
+    if ((value) > atomic_load_explicit(&(atomic), memory_order_relaxed)) \
+      atomic_store_explicit(&(atomic), (value), memory_order_relaxed); \
+  })
 
-  state->return_port = jack_port_register( state->jack_client
-                                         , "return"
-                                         , JACK_DEFAULT_AUDIO_TYPE
-                                         , JackPortIsInput
-                                         , 0
-                                         );
+// Monotonic clock in microseconds. JACK uses the same clock for
+// “jack_get_time()” and “jack_frames_to_time()”.
+static inline long long now_us(State *state)
+{
+  if (state->jack_client != NULL) return jack_get_time();
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
 
-  if (state->return_port == NULL) ERRJACK("Registering send port failed!");
+static inline long long frame_time_us(State *state, jack_nframes_t frame_time)
+{
+  if (state->jack_client != NULL)
+    return jack_frames_to_time(state->jack_client, frame_time);
 
-  LOG("Return JACK port is registered.");
+  return state->frames_epoch_us
+    + (long long)frame_time * 1000000 / state->sample_rate;
 }
 
-int set_sample_rate(jack_nframes_t nframes, void *arg)
+// Records the delivery latency of a value update that has been written
+// (see “DELIVERY_LATENCY_BUCKETS”), only when the stats are turned on.
+void record_delivery_latency(State *state, jack_nframes_t frame_time)
 {
-  State *state = (State *)arg;
-  state->sample_rate = nframes;
-  LOG("New JACK sample rate received: %d", nframes);
+  if (state->stats_interval == 0) return;
+  long long latency = now_us(state) - frame_time_us(state, frame_time);
+  unsigned long long us = MAX(latency, 0);
 
-  state->sine_wave_one_rotation_samples = round(
-    (sample_t)state->sample_rate / state->sine_wave_freq
-  );
+  unsigned int bucket = 0;
+  while (bucket < DELIVERY_LATENCY_BUCKETS - 1 && us >> bucket > 0) ++bucket;
 
-  if (state->use_default_rms_window_size) {
-    state->rms_window_size = state->sine_wave_one_rotation_samples;
-    LOG("New RMS window size: %d samples", state->rms_window_size);
-  }
+  atomic_fetch_add_explicit(
+    &state->stats.delivery_latency[bucket],
+    1,
+    memory_order_relaxed
+  );
 
-  return 0;
+  // Several consumers may record at once (socket server and the reporter
+  // resetting it), a lost maximum just shows up in the next report.
+  ATOMIC_STORE_MAX(state->stats.max_delivery_latency_us, us);
 }
 
-int set_buffer_size(jack_nframes_t nframes, void *arg)
+// Upper bound in µs of the bucket of the delivery latency histogram
+// the percentile falls into (0 if there are no values yet).
+unsigned long long delivery_latency_percentile(RtStats *stats, double percentile)
 {
-  State *state = (State *)arg;
-  state->buffer_size = nframes;
-  LOG("New JACK buffer size: %d", nframes);
+  unsigned long long total = 0, count = 0;
+
+  for (unsigned int i = 0; i < DELIVERY_LATENCY_BUCKETS; ++i)
+    total += atomic_load_explicit(&stats->delivery_latency[i], memory_order_relaxed);
+
+  for (unsigned int i = 0; total > 0 && i < DELIVERY_LATENCY_BUCKETS; ++i) {
+    count += atomic_load_explicit(&stats->delivery_latency[i], memory_order_relaxed);
+    if (count >= total * percentile / 100) return 1ULL << i;
+  }
+
   return 0;
 }
 
-void bind_callbacks(State *state, bool calibrate)
+// UDP datagram layout, a datagram per value update
+// (integers are big-endian, see also “udp_receiver.py”):
+//   0  uint8   format version (“UDP_DATAGRAM_VERSION”)
+//   1  uint8   channel number (starting from 1)
+//   2  uint8   value (in range from 0 to 255)
+//   3  uint8   reserved (0)
+//   4  uint32  sequence number, incremented for every datagram
+//   8  uint32  JACK frame time of the sample the value was detected at
+//  12  uint32  sample rate (to convert frame time to seconds)
+#define UDP_DATAGRAM_VERSION 1
+#define UDP_DATAGRAM_SIZE    16
+
+void send_udp_datagram(State *state, ValueUpdate update, int *last_errno)
 {
-  if (calibrate) {
-    LOG("Binding JACK process callback for calibration mode…");
-
-    if (jack_set_process_callback(
-      state->jack_client,
-      jack_process_calibrate,
-      (void *)state
-    )) ERRJACK("jack_set_process_callback() error!");
+  uint8_t buf[UDP_DATAGRAM_SIZE] = { UDP_DATAGRAM_VERSION, update.channel, update.value, 0 };
+  uint32_t sequence    = htonl(++state->udp_sequence);
+  uint32_t frame_time  = htonl(update.frame_time);
+  uint32_t sample_rate = htonl(state->sample_rate);
+  memcpy(buf + 4,  &sequence,    sizeof(uint32_t));
+  memcpy(buf + 8,  &frame_time,  sizeof(uint32_t));
+  memcpy(buf + 12, &sample_rate, sizeof(uint32_t));
+
+  if (sendto(
+    state->udp_socket_fd,
+    buf,
+    UDP_DATAGRAM_SIZE,
+    0,
+    (struct sockaddr *)&state->udp_address,
+    sizeof(state->udp_address)
+  ) == -1) {
+    // Datagram is lost anyway, don’t flood stderr with the same error.
+    if (errno != *last_errno)
+      fprintf(
+        stderr,
+        "WARNING: Failed to send UDP datagram #%u: %s\n",
+        state->udp_sequence,
+        strerror(errno)
+      );
 
-    LOG("JACK process callback for calibration mode is bound.");
+    *last_errno = errno;
   } else {
-    LOG("Binding JACK process callback…");
+    *last_errno = 0;
+  }
+}
 
-    if (jack_set_process_callback(
-      state->jack_client,
-      jack_process,
-      (void *)state
-    )) ERRJACK("jack_set_process_callback() error!");
+void* handle_value_updates(void *arg)
+{
+  State *state = (State *)arg;
 
-    LOG("JACK process callback is bound.");
-  }
+  bool is_text = state->output_format == OUTPUT_FORMAT_TEXT;
+  int stdout_fd = is_text ? -1 : dup(fileno(stdout));
+  int udp_errno = 0;
 
-  LOG("Binding JACK sample rate callback…");
+  unsigned int reported_overflows = 0;
+  ValueUpdate update;
+  char buf[VALUE_UPDATE_MAX_SIZE];
 
-  if (jack_set_sample_rate_callback(
-    state->jack_client,
-    set_sample_rate,
-    (void *)state
-  ) != 0) ERRJACK("jack_set_sample_rate_callback() error!");
+  for (;;) {
+    LOG("Waiting for a notification of a new value update…");
+    bool is_running = wait_for_values(state);
+    LOG("Received a notification of a change of the value.");
+    report_ring_overflows(
+      &state->value_changes_ring.overflows,
+      &reported_overflows
+    );
 
-  LOG("JACK sample rate callback is bound.");
+    // Handle whole ring before starting to wait again.
+    // The eventfd may be notified more times than there are values left in
+    // the ring (they were handled in one go), so empty wake-ups are fine.
+    while (RING_SHIFT(state->value_changes_ring, &update)) {
+      if (state->udp_socket_fd != -1) {
+        // Datagrams have 8-bit values.
+        if ( ! update.value_changed) continue;
+        send_udp_datagram(state, update, &udp_errno);
+      } else if ( ! is_value_update_visible(state->output_format, update)) {
+        continue;
+      } else if (is_text) {
+        format_value_update(state, state->output_format, update, buf);
+        fputs(buf, stdout);
+      } else {
+        size_t size =
+          format_value_update(state, state->output_format, update, buf);
+        if (write(stdout_fd, buf, size) == -1)
+          PERR("Failed to write binary data to stdout");
+      }
 
-  LOG("Binding JACK buffer size callback…");
+      record_delivery_latency(state, update.frame_time);
+    }
 
-  if (jack_set_buffer_size_callback(
-    state->jack_client,
-    set_buffer_size,
-    (void *)state
-  ) != 0) ERRJACK("jack_set_buffer_size_callback() error!");
+    // When stdout is a pipe it is fully buffered, the values would wait
+    // there until the buffer fills up (see “--latency-test”).
+    if (is_text) fflush(stdout);
+    if ( ! is_running) break;
+  }
 
-  LOG("JACK buffer size callback is bound.");
+  if (stdout_fd != -1) close(stdout_fd);
+  LOG("Value updates handling thread is stopped.");
+  return NULL;
 }
 
-typedef struct {
-  pthread_t           value_updates_handler_tid;
-  State               *state;
-} ShutdownPayload;
+void* handle_calibrate_value_updates(void *arg)
+{
+  State *state = (State *)arg;
 
-ShutdownPayload shutdown_payload = { -1, NULL };
+  unsigned int reported_overflows = 0;
+  DecibelsUpdate update;
 
-void terminate_app(bool jack_is_down)
-{
-  fprintf(stderr, "Terminating the app…\n");
+  for (;;) {
+    LOG("Waiting for a notification of a new RMS dB value update…");
+    bool is_running = wait_for_values(state);
+    LOG("Received a notification of a change of the RMS dB value.");
 
-  LOG("Cancelling value updates handling thread…");
-
-  if (pthread_cancel(shutdown_payload.value_updates_handler_tid) != 0)
-    ERR("pthread_cancel() error!");
-
-  LOG("Destroying value queue lock…");
-  pthread_mutex_destroy(&shutdown_payload.state->queue_lock);
-  LOG("Destroying value condition variable…");
-  pthread_cond_destroy(&shutdown_payload.state->queue_cond);
-
-  if (shutdown_payload.state->server_socket_fd != -1) {
-    LOG("Destroying connections lock…");
-    pthread_mutex_destroy(&shutdown_payload.state->connections_lock);
-
-    LOG("Closing opened client socket connections…");
-    Connection *current_connection = shutdown_payload.state->socket_connections;
-    shutdown_payload.state->socket_connections = NULL;
-    Connection *tmp_connection = NULL;
-
-    for (
-      int i = 1;
-      current_connection != NULL;
-      ++i,
-      tmp_connection = current_connection,
-      current_connection = current_connection->next,
-      tmp_connection->next = NULL,
-      free(tmp_connection)
-    ) {
-      LOG(
-        "Closing client socket connection #%d (FD: %d)…",
-        i,
-        current_connection->socket_fd
-      );
+    report_ring_overflows(
+      &state->calibration_values_ring.overflows,
+      &reported_overflows
+    );
 
-      if (close(current_connection->socket_fd) < 0) PERR(
-        "Failed to close client socket connection (FD: %d)",
-        current_connection->socket_fd
+    while (RING_SHIFT(state->calibration_values_ring, &update)) {
+      atomic_store_explicit(
+        &state->calibration_levels[update.channel - 1],
+        update.rms_db,
+        memory_order_relaxed
       );
-    }
 
-    LOG(
-      "Closing socket server (FD: %d)…",
-      shutdown_payload.state->server_socket_fd
-    );
+      if (state->channels_count > 1)
+        fprintf(stderr, "New RMS (channel #%d): %f dB\n", update.channel, update.rms_db);
+      else
+        fprintf(stderr, "New RMS: %f dB\n", update.rms_db);
+    }
 
-    if (close(shutdown_payload.state->server_socket_fd) < 0) PERR(
-      "Failed to close socket server (FD: %d)",
-      shutdown_payload.state->server_socket_fd
-    );
+    if ( ! is_running) break;
   }
 
-  if ( ! jack_is_down) {
-    LOG("Deactivating JACK client…");
+  LOG("RMS dB value updates handling thread is stopped.");
+  return NULL;
+}
 
-    if (jack_deactivate(shutdown_payload.state->jack_client) != 0)
-      ERRJACK("JACK client deactivation failed!");
+// Max amount of epoll events handled in one go by the socket server.
+#define SOCKET_SERVER_MAX_EVENTS 32
 
-    LOG("Closing JACK client…");
+// Max amount of value updates taken from the ring in one go
+// before handing them to the clients.
+#define SOCKET_SERVER_BATCH_SIZE 256
 
-    if (jack_client_close(shutdown_payload.state->jack_client) != 0)
-      ERRJACK("Closing JACK client failed!");
-  }
+void set_non_blocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
 
-  LOG("DONE!");
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    PERR("Failed to make FD %d non-blocking", fd);
 }
 
-void jack_shutdown_callback()
+// Parses “latest”, “bounded:N” or “full”.
+// Returns “false” if the string is not a valid delivery policy.
+bool parse_delivery_policy(const char *str, DeliveryPolicy *policy)
 {
-  LOG("Received JACK shutdown notification, terminating…");
-  terminate_app(true);
-}
+  if (EQ(str, "full")) {
+    *policy = (DeliveryPolicy) { DELIVERY_FULL, 0 };
+  } else if (EQ(str, "latest")) {
+    *policy = (DeliveryPolicy) { DELIVERY_LATEST, 0 };
+  } else if (strncmp(str, "bounded:", sizeof("bounded:") - 1) == 0) {
+    const char *bound = str + sizeof("bounded:") - 1;
+    char *end = NULL;
+    errno = 0;
+    unsigned long x = strtoul(bound, &end, 10);
+
+    if (
+      *bound < '0' || *bound > '9' || *end != '\0' || errno != 0
+      || x < 1 || x > UINT16_MAX
+    )
+      return false;
+
+    *policy = (DeliveryPolicy) { DELIVERY_BOUNDED, x };
+  } else {
+    return false;
+  }
 
-void sig_handler(int signum)
-{
-  LOG("Received “%s” signal, terminating the app…", strsignal(signum));
-  terminate_app(false);
+  return true;
 }
 
-void null_state(State *state)
+// Sets delivery policy of the client.
+// Value updates that are still pending are dropped (and counted).
+// Nothing is allocated, the queue goes back to the preallocated slot.
+// Returns “false” (and keeps the policy) if the bound does not fit the slot.
+bool set_connection_policy(Connection *connection, DeliveryPolicy policy)
 {
-  state->sample_rate = 0;
-  state->buffer_size = 0;
-
-  state->jack_client = NULL;
-  state->send_port   = NULL;
-  state->return_port = NULL;
-
-  state->last_value = 0;
+  if (
+    policy.mode == DELIVERY_BOUNDED
+    && policy.bound > connection->slot_capacity
+  )
+    return false;
 
-  state->binary_output = false;
+  connection->dropped += connection->queue_size;
 
-  memset(&state->queue_lock, 0, sizeof(pthread_mutex_t));
-  memset(&state->queue_cond, 0, sizeof(pthread_cond_t));
-  state->value_changes_queue.head = NULL;
-  state->value_changes_queue.tail = NULL;
-  state->calibration_values_queue.head = NULL;
-  state->calibration_values_queue.tail = NULL;
-
-  state->server_socket_fd = -1;
-  state->socket_connections = NULL;
-  memset(&state->connections_lock, 0, sizeof(pthread_mutex_t));
+  for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+    if (connection->latest_seq[i] != 0) ++connection->dropped;
+    connection->latest_seq[i] = 0;
+  }
 
-  state->sine_wave_freq                 = 0.0f;
-  state->sine_wave_sample_i             = 0;
-  state->sine_wave_one_rotation_samples = 0;
+  if (connection->queue != connection->slot) free(connection->queue);
+  connection->queue = connection->slot;
+  connection->queue_capacity =
+    policy.mode == DELIVERY_BOUNDED ? policy.bound : connection->slot_capacity;
+  connection->queue_head = 0;
+  connection->queue_size = 0;
 
-  RmsBounds rms_bounds               = { 0.0f, 0.0f };
-  state->rms_bounds                  = rms_bounds;
-  state->use_default_rms_window_size = false;
-  state->rms_window_size             = 0;
-  state->rms_window_sample_i         = 0;
-  state->rms_sum                     = 0.0f;
-  state->last_rms_db                 = 0.0f;
+  connection->policy = policy;
+  return true;
 }
 
-void init_socket_server(State *state)
+// Adds a value update to the pending ones according to the delivery policy.
+void queue_value_update(Connection *connection, ValueUpdate update)
 {
-  LOG("Initializing socket server…");
-  struct sockaddr_in server_address;
-  memset(&server_address, 0, sizeof(server_address));
+  if ( ! is_value_update_visible(connection->format, update)) return;
+  ++connection->seq;
+
+  if (connection->policy.mode == DELIVERY_LATEST) {
+    unsigned int i = update.channel - 1;
+    if (connection->latest_seq[i] != 0) ++connection->coalesced;
+    connection->latest[i] = update;
+    connection->latest_seq[i] = connection->seq;
+    return;
+  }
 
-  LOG("Opening a socket…");
-  state->server_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (state->server_socket_fd < 0) PERR("Failed to open a socket");
+  if (connection->queue_size == connection->queue_capacity) {
+    if (
+      connection->policy.mode == DELIVERY_BOUNDED
+      || connection->queue_capacity >= FULL_DELIVERY_QUEUE_MAX_CAPACITY
+    ) {
+      // Drop the oldest one.
+      connection->queue_head =
+        (connection->queue_head + 1) % connection->queue_capacity;
+      --connection->queue_size;
+      ++connection->dropped;
+    } else {
+      // Grow the queue, its items are moved to the beginning in order.
+      size_t capacity = MIN(
+        connection->queue_capacity * 2,
+        FULL_DELIVERY_QUEUE_MAX_CAPACITY
+      );
+      ValueUpdate *queue = malloc(sizeof(ValueUpdate) * capacity);
+      MALLOC_CHECK(queue);
+
+      for (size_t i = 0; i < connection->queue_size; ++i)
+        queue[i] = connection->queue[
+          (connection->queue_head + i) % connection->queue_capacity
+        ];
+
+      if (connection->queue != connection->slot) free(connection->queue);
+      connection->queue = queue;
+      connection->queue_capacity = capacity;
+      connection->queue_head = 0;
+    }
+  }
 
-  {
-    LOG("Setting socket server address option as reusable…");
-    int enable = 1;
-    if (setsockopt(
-      state->server_socket_fd,
-      SOL_SOCKET,
-      SO_REUSEADDR,
-      &enable,
-      sizeof(enable)
-    ) < 0)
-      PERR("Failed to set socket server address option as reusable");
+  connection->queue[
+    (connection->queue_head + connection->queue_size++)
+      % connection->queue_capacity
+  ] = update;
+}
+
+// Takes the next pending value update, the oldest one goes first.
+// Returns “false” if there are no pending value updates.
+bool shift_value_update(Connection *connection, ValueUpdate *update)
+{
+  if (connection->policy.mode == DELIVERY_LATEST) {
+    int oldest = -1;
+
+    for (int i = 0; i < MAX_CHANNELS; ++i)
+      if (
+        connection->latest_seq[i] != 0
+        && (oldest == -1
+            || connection->latest_seq[i] < connection->latest_seq[oldest])
+      )
+        oldest = i;
+
+    if (oldest == -1) return false;
+    *update = connection->latest[oldest];
+    connection->latest_seq[oldest] = 0;
+    return true;
   }
 
-  server_address.sin_family = AF_INET;
-  server_address.sin_addr.s_addr = INADDR_ANY;
-  server_address.sin_port = htons(socket_port);
+  if (connection->queue_size == 0) return false;
+  *update = connection->queue[connection->queue_head];
+  connection->queue_head =
+    (connection->queue_head + 1) % connection->queue_capacity;
+  --connection->queue_size;
+  return true;
+}
 
-  LOG("Binding socket on %d port…", socket_port);
-  if (bind(
-    state->server_socket_fd,
-    (struct sockaddr *)&server_address,
-    sizeof(server_address)
-  ) < 0)
-    PERR("Failed to bind socket to %d port", socket_port);
+// (Un)subscribes the client from “EPOLLOUT” events.
+// The client is subscribed only while it has some pending output,
+// otherwise epoll would wake up the server all the time.
+void watch_connection_writable(State *state, Connection *connection, bool on)
+{
+  if (connection->waiting_writable == on) return;
+
+  struct epoll_event event = {
+    .events = EPOLLIN | EPOLLRDHUP | (on ? EPOLLOUT : 0),
+    .data.ptr = connection,
+  };
+
+  if (epoll_ctl(
+    state->epoll_fd,
+    EPOLL_CTL_MOD,
+    connection->socket_fd,
+    &event
+  ) != 0)
+    PERR("Failed to modify epoll events of FD %d", connection->socket_fd);
+
+  connection->waiting_writable = on;
+}
 
-  LOG("Starting to listen for the socket…");
-  if (listen(state->server_socket_fd, 5) < 0)
-    PERR("Failed to start listening to a socket on %d port", socket_port);
+// Writes as much of the pending value updates of the client as the socket
+// takes without blocking. Returns “false” if the connection is lost.
+bool flush_connection(State *state, Connection *connection)
+{
+  for (;;) {
+    if (connection->buffer_size == 0) {
+      ValueUpdate update;
+      connection->buffer_offset = 0;
+      connection->buffer_updates = 0;
+      connection->buffer_written = 0;
+
+      while (
+        connection->buffer_size + VALUE_UPDATE_MAX_SIZE
+          <= CONNECTION_BUFFER_SIZE
+        && connection->buffer_updates < CONNECTION_BUFFER_UPDATES
+        && shift_value_update(connection, &update)
+      ) {
+        connection->buffer_size += format_value_update(
+          state,
+          connection->format,
+          update,
+          connection->buffer + connection->buffer_size
+        );
+
+        connection->buffer_frame_times[connection->buffer_updates] =
+          update.frame_time;
+        connection->buffer_ends[connection->buffer_updates++] =
+          connection->buffer_size;
+      }
+
+      if (connection->buffer_size == 0) break;
+    }
+
+    ssize_t written = send(
+      connection->socket_fd,
+      connection->buffer + connection->buffer_offset,
+      connection->buffer_size,
+      MSG_NOSIGNAL
+    );
+
+    if (written == -1) {
+      if (errno == EINTR) continue;
+
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        watch_connection_writable(state, connection, true);
+        return true;
+      }
+
+      fprintf(
+        stderr,
+        "Failed to write to client socket connection "
+        "(client socket FD: %d), taking it as lost connection: %s\n",
+        connection->socket_fd,
+        strerror(errno)
+      );
+
+      return false;
+    }
+
+    connection->buffer_offset += written;
+    connection->buffer_size -= written;
+
+    // The latency is recorded once the whole value update is written
+    while (
+      connection->buffer_written < connection->buffer_updates
+      && connection->buffer_ends[connection->buffer_written]
+        <= connection->buffer_offset
+    ) {
+      ++connection->sent;
+      record_delivery_latency(
+        state,
+        connection->buffer_frame_times[connection->buffer_written++]
+      );
+    }
+  }
+
+  watch_connection_writable(state, connection, false);
+  return true;
+}
+
+void close_connection(State *state, Connection *connection)
+{
+  fprintf(
+    stderr,
+    "Closing client socket connection (FD: %d): %llu value update(s) sent, "
+    "%llu dropped, %llu coalesced.\n",
+    connection->socket_fd,
+    connection->sent,
+    connection->dropped,
+    connection->coalesced
+  );
 
   LOG(
-    "Socket server is initialized (server socket FD: %d).",
-    state->server_socket_fd
+    "Removing the connection from the connections list "
+    "and closing client socket connection (FD: %d)…",
+    connection->socket_fd
+  );
+
+  if (connection->prev == NULL) state->socket_connections = connection->next;
+  else connection->prev->next = connection->next;
+  if (connection->next != NULL) connection->next->prev = connection->prev;
+
+  // Closing the FD removes it from the epoll set as well.
+  if (close(connection->socket_fd) < 0) PERR(
+    "Failed to close client socket connection (FD: %d)",
+    connection->socket_fd
   );
+
+  if (connection->queue != connection->slot) free(connection->queue);
+  connection->queue = NULL;
+  connection->prev = NULL;
+  connection->next = state->free_connections;
+  state->free_connections = connection;
 }
 
-void run
-( RmsBounds      rms_bounds
-, sample_t       sine_wave_freq  // 0 for default value
-, jack_nframes_t rms_window_size // 0 for default value
-, bool           binary_output
-, bool           socket_server
-, bool           calibrate
-)
+static inline long long monotonic_ms()
 {
-  LOG("Initializing a queue mutex…");
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
 
-  LOG("Initialization of state…");
-  State *state = (State *)malloc(sizeof(State));
-  MALLOC_CHECK(state);
-  null_state(state);
-  state->binary_output = binary_output;
-  if (pthread_mutex_init(&state->queue_lock, NULL) != 0)
-    ERR("pthread_mutex_init() error!");
-  if (pthread_cond_init(&state->queue_cond, NULL) != 0)
-    ERR("pthread_cond_init() error!");
-  if (socket_server)
-    if (pthread_mutex_init(&state->connections_lock, NULL) != 0)
-      ERR("pthread_mutex_init() error!");
-  state->sine_wave_freq = (sine_wave_freq == 0) ? 440.0f : sine_wave_freq;
-  state->rms_bounds = rms_bounds;
-  state->rms_bounds.rms_max_bound -= state->rms_bounds.rms_min_bound; // Precalculate
-  state->use_default_rms_window_size = rms_window_size == 0;
-  if (rms_window_size != 0) state->rms_window_size = rms_window_size;
-  LOG("State is initialized…");
+// Stops watching the listening socket for a while (see
+// “ACCEPT_BACKOFF_MIN_MS”), so the event loop does not spin on
+// the connections it can not take.
+void pause_accepting(State *state)
+{
+  state->accept_backoff_ms =
+    state->accept_backoff_ms == 0
+      ? ACCEPT_BACKOFF_MIN_MS
+      : MIN(state->accept_backoff_ms * 2, ACCEPT_BACKOFF_MAX_MS);
+
+  state->accept_resume_ms = monotonic_ms() + state->accept_backoff_ms;
+  LOG("Pausing accepting new connections for %u ms…", state->accept_backoff_ms);
+
+  struct epoll_event event = {
+    .events = 0,
+    .data.ptr = &state->server_socket_fd,
+  };
+
+  if (epoll_ctl(
+    state->epoll_fd,
+    EPOLL_CTL_MOD,
+    state->server_socket_fd,
+    &event
+  ) != 0)
+    PERR("Failed to modify epoll events of FD %d", state->server_socket_fd);
+}
 
-  LOG("Opening JACK client…");
-  jack_status_t status;
+// The pause is kept, it grows if accepting fails again right away,
+// it is reset only when a connection is admitted.
+void resume_accepting(State *state)
+{
+  LOG("Resuming accepting new connections…");
+  state->accept_resume_ms = 0;
 
-  state->jack_client = jack_client_open(
-    jack_client_name,
-    JackNullOption,
-    &status,
-    NULL
+  struct epoll_event event = {
+    .events = EPOLLIN,
+    .data.ptr = &state->server_socket_fd,
+  };
+
+  if (epoll_ctl(
+    state->epoll_fd,
+    EPOLL_CTL_MOD,
+    state->server_socket_fd,
+    &event
+  ) != 0)
+    PERR("Failed to modify epoll events of FD %d", state->server_socket_fd);
+}
+
+// Tells the client that there is no room for it and closes the connection.
+// Raw 8-bit binary format has no way to tell an error from the values,
+// the connection is just closed then.
+void reject_connection(State *state, int client_socket_fd)
+{
+  static const char text[] = "error: too many clients\n";
+
+  static const char frame[] = {
+    (char)FRAME_SYNC,
+    FRAME_VERSION,
+    FRAME_ERROR,
+    FRAME_ERROR_TOO_MANY_CLIENTS,
+  };
+
+  const char *data = NULL;
+  size_t size = 0;
+
+  switch (state->output_format) {
+    case OUTPUT_FORMAT_TEXT:
+      data = text;
+      size = sizeof(text) - 1;
+      break;
+    case OUTPUT_FORMAT_FRAMED_U16:
+    case OUTPUT_FORMAT_FRAMED_F32:
+      data = frame;
+      size = sizeof(frame);
+      break;
+    case OUTPUT_FORMAT_BINARY:
+      break;
+  }
+
+  // A new socket has an empty send buffer, it never blocks
+  if (size > 0) send(client_socket_fd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+  if (close(client_socket_fd) < 0) PERR(
+    "Failed to close rejected client socket connection (FD: %d)",
+    client_socket_fd
   );
+}
 
-  if (state->jack_client == NULL) ERRJACK("Opening client failed!");
+// Accepts all the pending client connections.
+void accept_connections(State *state)
+{
+  for (;;) {
+    struct sockaddr_in client_address;
+    memset(&client_address, 0, sizeof(client_address));
+    socklen_t client_address_length = sizeof(client_address);
 
-  if (status & JackNameNotUnique)
-    ERRJACK("Client name “%s” is already taken!", jack_client_name);
+    int client_socket_fd = accept(
+      state->server_socket_fd,
+      (struct sockaddr *)&client_address,
+      &client_address_length
+    );
 
-  LOG("JACK client is opened.");
-  register_ports(state);
-  bind_callbacks(state, calibrate);
+    if (client_socket_fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+      if (errno == EINTR || errno == ECONNABORTED) continue;
 
-  LOG("Running a thread for handing value updates queue…");
-  pthread_t value_updates_handler_tid = -1;
+      fprintf(
+        stderr,
+        "Failed to accept socket client connection: %s\n",
+        strerror(errno)
+      );
 
-  {
-    int err = pthread_create(
-      &value_updates_handler_tid,
-      NULL,
-      calibrate ? &handle_calibrate_value_updates : &handle_value_updates,
-      (void *)state
+      // Out of FDs or memory, the pending connection stays in the backlog
+      // and the listening socket stays readable.
+      pause_accepting(state);
+      return;
+    }
+
+    if (state->free_connections == NULL) {
+      fprintf(
+        stderr,
+        "Rejecting a socket connection from “%s” client, "
+        "all %u connection slots are taken.\n",
+        inet_ntoa(client_address.sin_addr),
+        state->max_clients
+      );
+
+      reject_connection(state, client_socket_fd);
+      pause_accepting(state);
+      return;
+    }
+
+    fprintf(
+      stderr,
+      "Received a socket connection from “%s” client (client socket FD: %d).\n",
+      inet_ntoa(client_address.sin_addr),
+      client_socket_fd
     );
 
-    if (err != 0) ERR("Failed to create a thread: [%s]", strerror(err));
+    set_non_blocking(client_socket_fd);
+
+    {
+      // Value updates are tiny and must go out right away.
+      int enable = 1;
+      if (setsockopt(
+        client_socket_fd,
+        IPPROTO_TCP,
+        TCP_NODELAY,
+        &enable,
+        sizeof(enable)
+      ) < 0)
+        PERR("Failed to disable Nagle’s algorithm for FD %d", client_socket_fd);
+    }
+
+    Connection *connection = state->free_connections;
+    state->free_connections = connection->next;
+    memset(connection, 0, sizeof(Connection));
+    connection->socket_fd = client_socket_fd;
+    connection->queue = NULL;
+    connection->slot =
+      state->queue_pool
+      + (connection - state->connection_pool) * state->queue_slot_capacity;
+    connection->slot_capacity = state->queue_slot_capacity;
+    connection->prev = NULL;
+    connection->next = NULL;
+    state->accept_backoff_ms = 0;
+    set_connection_policy(connection, state->delivery_policy);
+    connection->format = state->output_format;
+
+    struct epoll_event event = {
+      .events = EPOLLIN | EPOLLRDHUP,
+      .data.ptr = connection,
+    };
+
+    if (epoll_ctl(
+      state->epoll_fd,
+      EPOLL_CTL_ADD,
+      client_socket_fd,
+      &event
+    ) != 0)
+      PERR("Failed to add FD %d to epoll", client_socket_fd);
 
     LOG(
-      "Value updates handling thread is spawned (thread id: %ld).",
-      value_updates_handler_tid
+      "Prepending connection entity (socket FD: %d) "
+      "to the socket connections list…",
+      client_socket_fd
+    );
+
+    connection->next = state->socket_connections;
+    if (connection->next != NULL) connection->next->prev = connection;
+    state->socket_connections = connection;
+  }
+}
+
+// Handles a command line received from a socket client:
+//   “delivery POLICY” (see “--delivery”);
+//   “format FORMAT” (see “--format”), the data that is already formatted
+//   (partially sent value update) goes out first.
+void handle_connection_command(Connection *connection, char *line)
+{
+  LOG(
+    "Received a command “%s” from client socket connection (FD: %d).",
+    line,
+    connection->socket_fd
+  );
+
+  DeliveryPolicy policy;
+  OutputFormat format;
+
+  if (
+    strncmp(line, "format ", sizeof("format ") - 1) == 0
+    && parse_output_format(line + sizeof("format ") - 1, &format)
+  ) {
+    connection->format = format;
+
+    fprintf(
+      stderr,
+      "Client socket connection (FD: %d) switched output format to “%s”.\n",
+      connection->socket_fd,
+      line + sizeof("format ") - 1
+    );
+  } else if (
+    strncmp(line, "delivery ", sizeof("delivery ") - 1) == 0
+    && parse_delivery_policy(line + sizeof("delivery ") - 1, &policy)
+  ) {
+    if (set_connection_policy(connection, policy))
+      fprintf(
+        stderr,
+        "Client socket connection (FD: %d) switched delivery policy to “%s”.\n",
+        connection->socket_fd,
+        line + sizeof("delivery ") - 1
+      );
+    else
+      fprintf(
+        stderr,
+        "WARNING: Delivery policy “%s” of client socket connection (FD: %d) "
+        "is larger than its queue (%zu values), ignoring it!\n",
+        line + sizeof("delivery ") - 1,
+        connection->socket_fd,
+        connection->slot_capacity
+      );
+  } else {
+    fprintf(
+      stderr,
+      "WARNING: Unknown command “%s” from client socket connection "
+      "(FD: %d), ignoring it!\n",
+      line,
+      connection->socket_fd
+    );
+  }
+}
+
+// Reads command lines from the client.
+// Returns “false” if the connection is lost.
+bool read_connection(Connection *connection)
+{
+  for (;;) {
+    ssize_t result = read(
+      connection->socket_fd,
+      connection->input + connection->input_size,
+      CONNECTION_INPUT_SIZE - connection->input_size
+    );
+
+    if (result == 0) {
+      fprintf(
+        stderr,
+        "Client socket connection (FD: %d) is closed by the client.\n",
+        connection->socket_fd
+      );
+
+      return false;
+    }
+
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+
+      fprintf(
+        stderr,
+        "Failed to read from client socket connection "
+        "(client socket FD: %d), taking it as lost connection: %s\n",
+        connection->socket_fd,
+        strerror(errno)
+      );
+
+      return false;
+    }
+
+    connection->input_size += result;
+    char *line = connection->input, *end;
+
+    while (
+      (end = memchr(line, '\n', connection->input + connection->input_size - line))
+        != NULL
+    ) {
+      *end = '\0';
+      if (end > line && end[-1] == '\r') end[-1] = '\0';
+      handle_connection_command(connection, line);
+      line = end + 1;
+    }
+
+    connection->input_size -= line - connection->input;
+    memmove(connection->input, line, connection->input_size);
+
+    if (connection->input_size == CONNECTION_INPUT_SIZE) {
+      fprintf(
+        stderr,
+        "WARNING: Too long command line from client socket connection "
+        "(FD: %d), ignoring it!\n",
+        connection->socket_fd
+      );
+
+      connection->input_size = 0;
+    }
+  }
+}
+
+// Handles readiness of a client socket.
+// Returns “false” if the connection is lost.
+bool handle_connection_event(State *state, Connection *connection, uint32_t events)
+{
+  if ((events & EPOLLIN) && ! read_connection(connection)) return false;
+
+  if (events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+    fprintf(
+      stderr,
+      "Client socket connection (FD: %d) is lost.\n",
+      connection->socket_fd
     );
+
+    return false;
+  }
+
+  return (events & EPOLLOUT) ? flush_connection(state, connection) : true;
+}
+
+// Hands a batch of value updates from the ring to all the clients
+// in a single pass over the clients.
+void fan_out_value_updates(State *state)
+{
+  ValueUpdate batch[SOCKET_SERVER_BATCH_SIZE];
+  unsigned int batch_size = 0;
+
+  while (
+    batch_size < SOCKET_SERVER_BATCH_SIZE
+    && RING_SHIFT(state->value_changes_ring, &batch[batch_size])
+  ) {
+    LOG(
+      "Sending value update (%d) of channel #%d "
+      "to client socket connections…",
+      batch[batch_size].value,
+      batch[batch_size].channel
+    );
+
+    ++batch_size;
+  }
+
+  // The ring may be not drained yet. Instead of looping here (which never
+  // ends if the JACK thread is faster than the clients) the loop is woken up
+  // again after it handles the other events.
+  if (batch_size == SOCKET_SERVER_BATCH_SIZE)
+    eventfd_write(state->values_event_fd, 1);
+
+  Connection **link = &state->socket_connections;
+
+  while (*link != NULL) {
+    Connection *connection = *link;
+
+    for (unsigned int i = 0; i < batch_size; ++i)
+      queue_value_update(connection, batch[i]);
+
+    // If the client is already waiting to become writable there is no
+    // point in trying, the data goes out on the next “EPOLLOUT”.
+    if (connection->waiting_writable || flush_connection(state, connection))
+      link = &connection->next;
+    else
+      close_connection(state, connection); // “*link” is the next one now
+  }
+}
+
+// Socket server event loop. A single thread owns the listening socket and
+// all the client connections. It waits for new connections, readiness of
+// the clients and value updates from the JACK thread at once.
+// Writes are non-blocking, every client has its own pending value updates
+// (see “--delivery”), so a slow client never holds back the others.
+void* socket_server_loop(void *arg)
+{
+  State *state = (State *)arg;
+
+  unsigned int reported_overflows = 0;
+  struct epoll_event events[SOCKET_SERVER_MAX_EVENTS];
+
+  // Listening socket and the eventfd are told apart from the clients by
+  // their addresses in the state.
+  struct epoll_event server_event = {
+    .events = EPOLLIN,
+    .data.ptr = &state->server_socket_fd,
+  };
+
+  struct epoll_event values_event = {
+    .events = EPOLLIN,
+    .data.ptr = &state->values_event_fd,
+  };
+
+  struct epoll_event shutdown_event = {
+    .events = EPOLLIN,
+    .data.ptr = &shutdown_request,
+  };
+
+  if (
+    epoll_ctl(
+      state->epoll_fd,
+      EPOLL_CTL_ADD,
+      state->server_socket_fd,
+      &server_event
+    ) != 0
+    || epoll_ctl(
+      state->epoll_fd,
+      EPOLL_CTL_ADD,
+      state->values_event_fd,
+      &values_event
+    ) != 0
+    || (shutdown_request.pipe[0] != -1 && epoll_ctl(
+      state->epoll_fd,
+      EPOLL_CTL_ADD,
+      shutdown_request.pipe[0],
+      &shutdown_event
+    ) != 0)
+  )
+    PERR("Failed to add socket server FDs to epoll");
+
+  for (bool is_running = true; is_running;) {
+    int timeout_ms =
+      state->accept_resume_ms == 0
+        ? -1
+        : (int)MAX(state->accept_resume_ms - monotonic_ms(), 0);
+
+    LOG("Waiting for socket server events…");
+    int count =
+      epoll_wait(state->epoll_fd, events, SOCKET_SERVER_MAX_EVENTS, timeout_ms);
+
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      PERR("epoll_wait() error");
+    }
+
+    if (state->accept_resume_ms != 0 && monotonic_ms() >= state->accept_resume_ms)
+      resume_accepting(state);
+
+    bool values_ready = false;
+
+    for (int i = 0; i < count; ++i) {
+      void *ptr = events[i].data.ptr;
+
+      if (ptr == &shutdown_request) {
+        is_running = false;
+      } else if (ptr == &state->values_event_fd) {
+        values_ready = true;
+      } else if (ptr == &state->server_socket_fd) {
+        accept_connections(state);
+      } else if ( ! handle_connection_event(state, ptr, events[i].events)) {
+        close_connection(state, ptr);
+      }
+    }
+
+    // Value updates are handled after the client events, because the fan-out
+    // may close connections that still have events in the array above.
+    if (values_ready) {
+      LOG("Received a notification of a change of the value.");
+      // Resets the counter, it does not block now
+      if ( ! wait_for_values(state)) is_running = false;
+
+      report_ring_overflows(
+        &state->value_changes_ring.overflows,
+        &reported_overflows
+      );
+
+      fan_out_value_updates(state);
+    }
+  }
+
+  LOG("Closing client socket connections…");
+
+  while (state->socket_connections != NULL)
+    close_connection(state, state->socket_connections);
+
+  LOG("Socket server thread is stopped.");
+  return NULL;
+}
+
+static inline sample_t sample_radians
+( sample_t       hz
+, jack_nframes_t sample_n
+, jack_nframes_t sample_rate
+)
+{
+  return (sample_t)sample_n * hz * 2 * M_PI / (sample_t)sample_rate;
+}
+
+// Should return “uint32_t” but in calculations everywhere “int64_t” is used.
+static inline sample_t finalize_mean_square
+( jack_nframes_t window_size
+, sample_t       sum
+)
+{
+  // Running sum of the sliding window may go slightly below zero
+  // because of the rounding errors.
+  return 1.0f / (sample_t)window_size * MAX(sum, 0.0f);
+}
+
+static inline sample_t finalize_rms_db(jack_nframes_t window_size, sample_t sum)
+{
+  return AMP_TO_DB(finalize_mean_square(window_size, sum));
+}
+
+// (Re)builds the oscillator for the current sample rate and sine wave frequency.
+// Must not be called from the realtime thread (it allocates). The old table
+// is freed, so the channel must not be processed meanwhile: it is either
+// a copy (see “reload_channel()”) or the processing is paused
+// (see “set_sample_rate()”).
+void init_oscillator(Channel *channel)
+{
+  Oscillator     *osc      = &channel->oscillator;
+  jack_nframes_t rotation  = channel->sine_wave_one_rotation_samples;
+  sample_t       *old_wavetable = osc->wavetable;
+
+  osc->wavetable = NULL;
+
+  if (osc->type == OSCILLATOR_WAVETABLE) {
+    LOG("Building a wavetable of %d samples…", rotation);
+    sample_t *wavetable = malloc(sizeof(sample_t) * rotation);
+    MALLOC_CHECK(wavetable);
+
+    // Exactly the same calculation as for “OSCILLATOR_SIN”
+    // so the output is bit-identical.
+    for (jack_nframes_t i = 0; i < rotation; ++i)
+      wavetable[i] = sin(sample_radians(
+        channel->sine_wave_freq,
+        i,
+        channel->sample_rate
+      ));
+
+    osc->wavetable = wavetable;
   }
 
-  if (socket_server) {
-    init_socket_server(state);
-    pthread_t socket_connection_handler_tid = -1;
+  double step = 2 * M_PI * channel->sine_wave_freq / channel->sample_rate;
+  osc->rotation_re = cos(step);
+  osc->rotation_im = sin(step);
+  osc->phasor_re   = 1.0;
+  osc->phasor_im   = 0.0;
+
+  channel->sine_wave_sample_i = 0;
+  free(old_wavetable);
+}
+
+// Fills the buffer with next “nframes” samples of the sine wave
+// and moves the sine wave position forward.
+void render_sine_wave(Channel *channel, sample_t *buf, jack_nframes_t nframes)
+{
+  Oscillator     *osc      = &channel->oscillator;
+  jack_nframes_t rotation  = channel->sine_wave_one_rotation_samples;
+  jack_nframes_t sample_i  = channel->sine_wave_sample_i;
+
+  switch (osc->type) {
+    case OSCILLATOR_SIN:
+      for (jack_nframes_t i = 0; i < nframes; ++i) {
+        buf[i] = sin(sample_radians(
+          channel->sine_wave_freq,
+          sample_i,
+          channel->sample_rate
+        ));
+
+        sample_i = (sample_i + 1) % rotation;
+      }
+      break;
+
+    case OSCILLATOR_WAVETABLE:
+      for (jack_nframes_t i = 0, n = 0; i < nframes; i += n) {
+        n = MIN(nframes - i, rotation - sample_i);
+        memcpy(buf + i, osc->wavetable + sample_i, n * sizeof(sample_t));
+        sample_i = (sample_i + n) % rotation;
+      }
+      break;
+
+    case OSCILLATOR_RECURSIVE: {
+      double re = osc->phasor_re, im = osc->phasor_im, tmp = 0.0;
+
+      for (jack_nframes_t i = 0; i < nframes; ++i) {
+        if (sample_i == 0) { re = 1.0; im = 0.0; }
+        buf[i] = (sample_t)im;
+        tmp = re * osc->rotation_re - im * osc->rotation_im;
+        im  = re * osc->rotation_im + im * osc->rotation_re;
+        re  = tmp;
+        sample_i = (sample_i + 1) % rotation;
+      }
+
+      osc->phasor_re = re;
+      osc->phasor_im = im;
+      break;
+    }
+  }
+
+  channel->sine_wave_sample_i = sample_i;
+}
+
+// Max absolute deviation of any oscillator backend from the “sin()” reference.
+// The wavetable is bit-identical, the recursive oscillator differs by about
+// 1e-7 (the reference rounds the phase to “float” before calling “sin()”).
+#define OSCILLATOR_MAX_ERROR 1e-6
+
+// Renders a few rotations of the sine wave using the configured oscillator
+// of the freshly initialized channel and compares it with the reference
+// “sin()” implementation (see “--self-test”).
+bool check_oscillator(Channel *channel)
+{
+  jack_nframes_t n = channel->sine_wave_one_rotation_samples * 4;
+  Channel tmp_channel = *channel;
+  tmp_channel.sine_wave_sample_i = 0;
+  sample_t *buf = malloc(sizeof(sample_t) * n);
+  MALLOC_CHECK(buf);
+  render_sine_wave(&tmp_channel, buf, n);
+  sample_t max_error = 0.0f;
+
+  for (jack_nframes_t i = 0; i < n; ++i) {
+    sample_t reference = sin(sample_radians(
+      channel->sine_wave_freq,
+      i % channel->sine_wave_one_rotation_samples,
+      channel->sample_rate
+    ));
+
+    max_error = MAX(max_error, fabsf(buf[i] - reference));
+  }
+
+  free(buf);
+  bool ok = max_error <= OSCILLATOR_MAX_ERROR;
+
+  printf(
+    "%s oscillator %-10s %6.0f Hz at %6d Hz, max error against “sin()”: %g\n",
+    ok ? "PASS" : "FAIL",
+    channel->oscillator.type == OSCILLATOR_SIN
+      ? "sin"
+      : channel->oscillator.type == OSCILLATOR_WAVETABLE
+        ? "wavetable"
+        : "recursive",
+    channel->sine_wave_freq,
+    channel->sample_rate,
+    max_error
+  );
+
+  return ok;
+}
+
+// Sum of squares of the samples (RMS accumulation).
+// Buffer does not have to be aligned (segments start at any offset).
+sample_t sum_of_squares(const sample_t *buf, jack_nframes_t n)
+{
+  jack_nframes_t i = 0;
+  sample_t sum = 0.0f;
+
+#if defined(SUM_OF_SQUARES_NEON)
+  float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+
+  for (; i + 8 <= n; i += 8) {
+    float32x4_t a = vld1q_f32(buf + i), b = vld1q_f32(buf + i + 4);
+    acc0 = vmlaq_f32(acc0, a, a);
+    acc1 = vmlaq_f32(acc1, b, b);
+  }
+
+  acc0 = vaddq_f32(acc0, acc1);
+  float32x2_t half = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+  sum = vget_lane_f32(vpadd_f32(half, half), 0);
+#elif defined(SUM_OF_SQUARES_AVX)
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+
+  for (; i + 16 <= n; i += 16) {
+    __m256 a = _mm256_loadu_ps(buf + i), b = _mm256_loadu_ps(buf + i + 8);
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(a, a));
+    acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(b, b));
+  }
+
+  acc0 = _mm256_add_ps(acc0, acc1);
+  __m128 acc = _mm_add_ps(
+    _mm256_castps256_ps128(acc0),
+    _mm256_extractf128_ps(acc0, 1)
+  );
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+  sum = _mm_cvtss_f32(acc);
+#elif defined(SUM_OF_SQUARES_SSE2)
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+
+  for (; i + 8 <= n; i += 8) {
+    __m128 a = _mm_loadu_ps(buf + i), b = _mm_loadu_ps(buf + i + 4);
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(a, a));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(b, b));
+  }
+
+  acc0 = _mm_add_ps(acc0, acc1);
+  acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+  acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+  sum = _mm_cvtss_f32(acc0);
+#endif
+
+  // Tail (or everything for the scalar backend)
+  for (; i < n; ++i) sum += buf[i] * buf[i];
+  return sum;
+}
+
+// (Re)initializes the detector state for the current window size
+// and sine wave rotation. Must not be called from the realtime thread
+// (it allocates).
+void init_detector(Channel *channel)
+{
+  sample_t *old_history    = channel->rms_history;
+  sample_t *old_lockin_sin = channel->lockin_sin;
+  sample_t *old_lockin_cos = channel->lockin_cos;
+  channel->rms_history = NULL;
+  channel->lockin_sin  = NULL;
+  channel->lockin_cos  = NULL;
+
+  if (channel->detector == DETECTOR_LOCKIN) {
+    jack_nframes_t rotation = channel->sine_wave_one_rotation_samples;
+    LOG("Building lock-in reference tables of %d samples…", rotation);
+    sample_t *lockin_sin = malloc(sizeof(sample_t) * rotation);
+    MALLOC_CHECK(lockin_sin);
+    sample_t *lockin_cos = malloc(sizeof(sample_t) * rotation);
+    MALLOC_CHECK(lockin_cos);
+
+    for (jack_nframes_t i = 0; i < rotation; ++i) {
+      sample_t radians =
+        sample_radians(channel->sine_wave_freq, i, channel->sample_rate);
+      lockin_sin[i] = sin(radians);
+      lockin_cos[i] = cos(radians);
+    }
+
+    channel->lockin_sin = lockin_sin;
+    channel->lockin_cos = lockin_cos;
+  }
+
+  if (channel->rms_mode == RMS_MODE_SLIDING) {
+    LOG(
+      "Allocating sliding RMS window of %d samples…",
+      channel->rms_window_size
+    );
+    sample_t *history = calloc(channel->rms_window_size, sizeof(sample_t));
+    MALLOC_CHECK(history);
+    channel->rms_history = history;
+
+    if (channel->use_default_rms_hop_size) {
+      channel->rms_hop_size = MAX(channel->rms_window_size / 4, 1);
+      LOG("New RMS hop size: %d samples", channel->rms_hop_size);
+    }
+  }
+
+  channel->rms_window_sample_i = 0;
+  channel->rms_hop_sample_i    = 0;
+  channel->rms_sum             = 0.0f;
+  channel->lockin_i_sum        = 0.0f;
+  channel->lockin_q_sum        = 0.0f;
+  free(old_history);
+  free(old_lockin_sin);
+  free(old_lockin_cos);
+}
+
+// “offset” is the frame offset in the current buffer of the last sample
+// of the window the value was detected from. The level is handed over as
+// a mean square, so the handlers that only quantize it do not need any
+// logarithm (see “handle_mean_square()”).
+typedef void (*RmsHandler)
+  (State *state, Channel *channel, jack_nframes_t offset, sample_t mean_square);
+
+// Adds samples to the current RMS window. Every time the window is complete
+// its RMS is handed to the handler and a new window is started.
+static inline void process_rms_tumbling
+( State          *state
+, Channel        *channel
+, const sample_t *buf
+, jack_nframes_t nframes
+, RmsHandler     handler
+)
+{
+  for (jack_nframes_t i = 0, n = 0; i < nframes; i += n) {
+    n = MIN(
+      nframes - i,
+      channel->rms_window_size
+        - MIN(channel->rms_window_sample_i, channel->rms_window_size)
+    );
+
+    channel->rms_sum += sum_of_squares(buf + i, n);
+    channel->rms_window_sample_i += n;
+    if (channel->rms_window_sample_i < channel->rms_window_size) break;
+
+    sample_t mean_square =
+      finalize_mean_square(channel->rms_window_size, channel->rms_sum);
+    channel->rms_window_sample_i = 0;
+    channel->rms_sum = 0.0f;
+    handler(state, channel, i + n - 1, mean_square);
+  }
+}
+
+// Moving window. A running sum of squares is updated by adding new samples
+// and subtracting those that leave the window, the RMS is handed to the
+// handler every “rms_hop_size” samples.
+//
+// Once per full rotation of the history buffer the running sum is recalculated
+// from scratch so the rounding errors of the additions and subtractions
+// do not accumulate (it costs one more sum-of-squares of the window per window,
+// so about one extra multiply-add per sample).
+static inline void process_rms_sliding
+( State          *state
+, Channel        *channel
+, const sample_t *buf
+, jack_nframes_t nframes
+, RmsHandler     handler
+)
+{
+  for (jack_nframes_t i = 0, n = 0; i < nframes; i += n) {
+    n = MIN(
+      nframes - i,
+      MIN(
+        channel->rms_window_size - channel->rms_window_sample_i,
+        channel->rms_hop_size - channel->rms_hop_sample_i
+      )
+    );
+
+    sample_t *history = channel->rms_history + channel->rms_window_sample_i;
+    channel->rms_sum += sum_of_squares(buf + i, n) - sum_of_squares(history, n);
+    memcpy(history, buf + i, n * sizeof(sample_t));
+    channel->rms_window_sample_i += n;
+    channel->rms_hop_sample_i += n;
+
+    if (channel->rms_window_sample_i >= channel->rms_window_size) {
+      channel->rms_window_sample_i = 0;
+      // Drift correction
+      channel->rms_sum =
+        sum_of_squares(channel->rms_history, channel->rms_window_size);
+    }
+
+    if (channel->rms_hop_sample_i >= channel->rms_hop_size) {
+      channel->rms_hop_sample_i = 0;
+      handler(
+        state,
+        channel,
+        i + n - 1,
+        finalize_mean_square(channel->rms_window_size, channel->rms_sum)
+      );
+    }
+  }
+}
+
+static inline void process_rms
+( State          *state
+, Channel        *channel
+, const sample_t *buf
+, jack_nframes_t nframes
+, RmsHandler     handler
+)
+{
+  if (channel->rms_mode == RMS_MODE_SLIDING)
+    process_rms_sliding(state, channel, buf, nframes, handler);
+  else
+    process_rms_tumbling(state, channel, buf, nframes, handler);
+}
+
+// Lock-in (synchronous I/Q) detector. The returned signal is correlated with
+// the reference sine and cosine waves over “rms_window_size” samples.
+// Anything that is not at the frequency of the sent sine wave (mains hum,
+// noise, DC) averages out, and the result does not depend on the phase shift
+// (latency) of the returned signal.
+//
+// For a sine wave of amplitude A: I² + Q² = (A·N/2)², mean square is A²/2,
+// so the value handed to the handler is the same as RMS detector would report
+// for the clean signal (same bounds work for both detectors).
+//
+// “phase” is the position of the sine wave at the first sample of the buffer.
+static inline void process_lockin
+( State          *state
+, Channel        *channel
+, const sample_t *buf
+, jack_nframes_t nframes
+, jack_nframes_t phase
+, RmsHandler     handler
+)
+{
+  jack_nframes_t rotation = channel->sine_wave_one_rotation_samples;
+
+  for (jack_nframes_t i = 0, n = 0; i < nframes; i += n) {
+    n = MIN(
+      nframes - i,
+      MIN(
+        channel->rms_window_size
+          - MIN(channel->rms_window_sample_i, channel->rms_window_size),
+        rotation - phase
+      )
+    );
+
+    const sample_t *x = buf + i;
+    const sample_t *ref_sin = channel->lockin_sin + phase;
+    const sample_t *ref_cos = channel->lockin_cos + phase;
+    sample_t i_sum = 0.0f, q_sum = 0.0f;
+
+    for (jack_nframes_t j = 0; j < n; ++j) {
+      i_sum += x[j] * ref_sin[j];
+      q_sum += x[j] * ref_cos[j];
+    }
+
+    channel->lockin_i_sum += i_sum;
+    channel->lockin_q_sum += q_sum;
+    channel->rms_window_sample_i += n;
+    phase = (phase + n) % rotation;
+    if (channel->rms_window_sample_i < channel->rms_window_size) continue;
+
+    sample_t window_size = channel->rms_window_size;
+    sample_t mean_square = 2 * (
+      channel->lockin_i_sum * channel->lockin_i_sum +
+      channel->lockin_q_sum * channel->lockin_q_sum
+    ) / (window_size * window_size);
+
+    channel->rms_window_sample_i = 0;
+    channel->lockin_i_sum = 0.0f;
+    channel->lockin_q_sum = 0.0f;
+    handler(state, channel, i + n - 1, mean_square);
+  }
+}
+
+// Runs the configured detector over the returned signal.
+// “phase” is the position of the sine wave at the first sample of the buffer.
+static inline void process_detector
+( State          *state
+, Channel        *channel
+, const sample_t *buf
+, jack_nframes_t nframes
+, jack_nframes_t phase
+, RmsHandler     handler
+)
+{
+  if (channel->detector == DETECTOR_LOCKIN)
+    process_lockin(state, channel, buf, nframes, phase, handler);
+  else
+    process_rms(state, channel, buf, nframes, handler);
+}
+
+// Allowed relative deviation of the SIMD kernel from the reference “rms()”
+// (summation order differs, so it is not bit-exact).
+#define SUM_OF_SQUARES_MAX_ERROR 1e-5
+
+sample_t rms(sample_t *samples_list, jack_nframes_t window_size);
+
+// Compares the sum-of-squares kernel with the reference “rms()” for different
+// lengths and (mis)alignments of the buffer (see “--self-test”).
+bool check_sum_of_squares()
+{
+  jack_nframes_t size = 1024;
+  sample_t *buf = malloc(sizeof(sample_t) * size);
+  MALLOC_CHECK(buf);
+  for (jack_nframes_t i = 0; i < size; ++i) buf[i] = sinf(i * 0.37f) * 0.8f;
+  double max_error = 0.0;
+
+  for (jack_nframes_t offset = 0; offset < 8; ++offset) {
+    for (jack_nframes_t n = 1; n + offset <= size; n += 1 + n / 4) {
+      sample_t reference = rms(buf + offset, n);
+      sample_t result = sum_of_squares(buf + offset, n) / (sample_t)n;
+      max_error = MAX(max_error, fabs(result - reference) / reference);
+    }
+  }
+
+  free(buf);
+  bool ok = max_error <= SUM_OF_SQUARES_MAX_ERROR;
+
+  printf(
+    "%s sum of squares kernel (%s), max relative error against “rms()”: %g\n",
+    ok ? "PASS" : "FAIL",
+    SUM_OF_SQUARES_BACKEND,
+    max_error
+  );
+
+  return ok;
+}
+
+// Adds a Control Change event to the events of the current period
+// (realtime-safe, see “write_midi_events()”).
+static inline void push_midi_cc
+( State          *state
+, jack_nframes_t offset
+, uint8_t        controller
+, uint8_t        value
+)
+{
+  if (state->midi_events_count >= MIDI_EVENTS_MAX) {
+    atomic_fetch_add_explicit(&state->stats.midi_dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  MidiEvent *event = &state->midi_events[state->midi_events_count++];
+  event->offset  = offset;
+  event->data[0] = MIDI_CONTROL_CHANGE | state->midi.channel;
+  event->data[1] = controller;
+  event->data[2] = value;
+}
+
+// Makes MIDI CC event(s) when the value changes in MIDI resolution.
+// For 14-bit values the MSB is (re)sent only together with the LSB since
+// receivers may reset the LSB when they get an MSB.
+static inline void handle_midi_value
+( State          *state
+, Channel        *channel
+, jack_nframes_t offset
+, uint16_t       value16
+)
+{
+  uint16_t value = state->midi.fine ? value16 >> 2 : value16 >> 9;
+  uint16_t last_value = channel->last_midi_value;
+  if (value == last_value) return;
+  channel->last_midi_value = value;
+
+  if ( ! state->midi.fine) {
+    push_midi_cc(state, offset, channel->midi_cc, value);
+    return;
+  }
+
+  if (last_value == MIDI_VALUE_NONE || value >> 7 != last_value >> 7)
+    push_midi_cc(state, offset, channel->midi_cc, value >> 7);
+
+  push_midi_cc(
+    state,
+    offset,
+    channel->midi_cc + MIDI_CC_LSB_OFFSET,
+    value & 0x7F
+  );
+}
+
+// Writes collected MIDI events of the period to the MIDI port. JACK requires
+// the events to be written in order of their frame offsets. Events of every
+// channel are already in order, so it is sorted by insertion (stable, so
+// MSB stays before LSB, and it is cheap for the few events of a period).
+void write_midi_events(State *state, jack_nframes_t nframes)
+{
+  void *buf = jack_port_get_buffer(state->midi_port, nframes);
+  jack_midi_clear_buffer(buf);
+  MidiEvent *events = state->midi_events;
+
+  for (unsigned int i = 1; i < state->midi_events_count; ++i) {
+    MidiEvent event = events[i];
+    unsigned int j = i;
+
+    for (; j > 0 && events[j - 1].offset > event.offset; --j)
+      events[j] = events[j - 1];
+
+    events[j] = event;
+  }
+
+  // Writing fails only when the port buffer is full, the rest is dropped then
+  for (unsigned int i = 0; i < state->midi_events_count; ++i) {
+    if (jack_midi_event_write(buf, events[i].offset, events[i].data, 3) != 0) {
+      atomic_fetch_add_explicit(
+        &state->stats.midi_dropped,
+        state->midi_events_count - i,
+        memory_order_relaxed
+      );
+      break;
+    }
+  }
+
+  state->midi_events_count = 0;
+}
+
+// Renders the control signal up to (not including) “until” sample of
+// the current buffer. The signal follows the last detected position through
+// a one-pole low-pass filter, so the steps between detector updates are
+// smoothed out (“cv_coeff” is 1 without smoothing).
+static inline void render_cv
+( State          *state
+, Channel        *channel
+, jack_nframes_t until
+)
+{
+  sample_t coeff = state->cv_coeff, target = channel->cv_target;
+  sample_t value = channel->cv_value, *buf = channel->cv_buf;
+
+  for (jack_nframes_t i = channel->cv_sample_i; i < until; ++i) {
+    value += coeff * (target - value);
+    buf[i] = value;
+  }
+
+  channel->cv_value = value;
+  channel->cv_sample_i = until;
+}
+
+// Cutoff frequency of the slope estimation of the One-Euro filter.
+#define ONE_EURO_SLOPE_CUTOFF 1.0f // in Hz
+
+// Smoothing factor of a first-order low-pass filter for the time step.
+static inline sample_t one_euro_alpha(sample_t cutoff, sample_t dt)
+{
+  sample_t tau = 1.0f / (2.0f * (sample_t)M_PI * cutoff);
+  return 1.0f / (1.0f + tau / dt);
+}
+
+// One-Euro filter (Casiez, Roussel, Vogel, 2012): a low-pass filter whose
+// cutoff grows with the speed of the change. A pedal at rest is smoothed
+// heavily (no flickering between adjacent values) while a moving pedal
+// gets little lag. Time steps come from the frame times of the values,
+// so it works the same for any window, hop and buffer size.
+static inline sample_t filter_one_euro
+( State          *state
+, Channel        *channel
+, sample_t       rms_db
+, jack_nframes_t frame_time
+)
+{
+  if ( ! channel->one_euro_primed) {
+    channel->one_euro_primed = true;
+    channel->one_euro_value = rms_db;
+    channel->one_euro_slope = 0.0f;
+    channel->one_euro_frame_time = frame_time;
+    return rms_db;
+  }
+
+  jack_nframes_t frames = frame_time - channel->one_euro_frame_time;
+  if (frames == 0) return channel->one_euro_value;
+  sample_t dt = (sample_t)frames / state->sample_rate;
+  channel->one_euro_frame_time = frame_time;
+
+  sample_t slope = (rms_db - channel->one_euro_value) / dt;
+  channel->one_euro_slope +=
+    one_euro_alpha(ONE_EURO_SLOPE_CUTOFF, dt) * (slope - channel->one_euro_slope);
+
+  sample_t cutoff = channel->one_euro_min_cutoff
+    + channel->one_euro_beta * fabsf(channel->one_euro_slope);
+  channel->one_euro_value +=
+    one_euro_alpha(cutoff, dt) * (rms_db - channel->one_euro_value);
+
+  return channel->one_euro_value;
+}
+
+// Quantization hysteresis: the value stays unless the unquantized one
+// (“scaled”, in value steps) moved further than half a step plus
+// “hysteresis” steps away from it. Without it a pedal at rest near
+// the middle between two values flickers between them. The ends of
+// the range are always reachable.
+static inline bool is_held_by_hysteresis
+( double         scaled
+, unsigned int   value
+, unsigned int   last_value
+, unsigned int   max_value
+, sample_t       hysteresis
+)
+{
+  return value != last_value
+    && value != 0
+    && value != max_value
+    && fabs(scaled - last_value) < 0.5 + hysteresis;
+}
+
+// Amount of segments of the response curve tables.
+#define CURVE_TABLE_SIZE 1024
+
+// Shape of a built-in response curve, “x” and the result are from 0 to 1.
+static double builtin_curve(CurveType curve, double x)
+{
+  switch (curve) {
+    case CURVE_LOG: return log10(1 + 9 * x);
+    case CURVE_EXP: return (pow(10, x) - 1) / 9;
+    case CURVE_S:   return x * x * (3 - 2 * x);
+    default:        return x;
+  }
+}
+
+// Position of a dB level on the recorded curve, linear interpolation
+// between the points, clamped to the first and the last one.
+static double recorded_curve(const CurvePoints *points, double rms_db)
+{
+  if (rms_db <= points->rms_db[0]) return points->position[0];
+
+  for (unsigned int i = 1; i < points->count; ++i) {
+    if (rms_db > points->rms_db[i]) continue;
+    double span = points->rms_db[i] - points->rms_db[i - 1];
+    if (span <= 0) return points->position[i];
+
+    return points->position[i - 1]
+      + (points->position[i] - points->position[i - 1])
+        * (rms_db - points->rms_db[i - 1]) / span;
+  }
+
+  return points->position[points->count - 1];
+}
+
+// Compiles the response curve of the channel to a table over the linear
+// position between the bounds (so the recorded curves are resampled).
+// The bounds must be precalculated already (see “new_state()”).
+// Allocates, must not be called from the realtime thread.
+void init_curve(Channel *channel)
+{
+  if (channel->curve == CURVE_LINEAR) return;
+
+  channel->curve_table = malloc(sizeof(sample_t) * (CURVE_TABLE_SIZE + 1));
+  MALLOC_CHECK(channel->curve_table);
+
+  for (unsigned int i = 0; i <= CURVE_TABLE_SIZE; ++i) {
+    double x = (double)i / CURVE_TABLE_SIZE;
+
+    double y = channel->curve == CURVE_POINTS
+      ? recorded_curve(
+          &channel->curve_points,
+          channel->rms_bounds.rms_min_bound
+            + x * channel->rms_bounds.rms_max_bound
+        )
+      : builtin_curve(channel->curve, x);
+
+    channel->curve_table[i] = MIN(MAX(y, 0.0), 1.0);
+
+    // The mapping must never go down, the value thresholds rely on it
+    // (see “init_value_thresholds()”).
+    if (i > 0 && channel->curve_table[i] < channel->curve_table[i - 1])
+      channel->curve_table[i] = channel->curve_table[i - 1];
+  }
+}
+
+// Linear interpolation in the curve table, “position” is from 0 to 1.
+// Never goes above the end of the segment, so it never goes down.
+static inline float apply_curve(const sample_t *table, float position)
+{
+  float x = position * CURVE_TABLE_SIZE;
+  unsigned int i = MIN((unsigned int)x, CURVE_TABLE_SIZE - 1);
+  float a = table[i], b = table[i + 1];
+  float y = a + (b - a) * (x - i);
+  return MIN(y, b);
+}
+
+static inline float rms_db_to_position(const Channel *channel, sample_t rms_db)
+{
+  float position = MIN(MAX(
+    (rms_db - channel->rms_bounds.rms_min_bound)
+      / channel->rms_bounds.rms_max_bound,
+    0.0f
+  ), 1.0f);
+
+  return channel->curve_table == NULL
+    ? position
+    : apply_curve(channel->curve_table, position);
+}
+
+// dB level in 8-bit value steps, not rounded nor clamped
+// (clamped by the response curve if there is one).
+static inline sample_t scale_rms_db(const Channel *channel, sample_t rms_db)
+{
+  if (channel->curve_table != NULL)
+    return rms_db_to_position(channel, rms_db) * UINT8_MAX;
+
+  return (rms_db - channel->rms_bounds.rms_min_bound)
+    * UINT8_MAX / channel->rms_bounds.rms_max_bound;
+}
+
+static inline uint8_t quantize_scaled_value(sample_t scaled)
+{
+  return MIN(MAX(round(scaled), 0), UINT8_MAX);
+}
+
+static inline uint16_t quantize_position(float position)
+{
+  return round(position * UINT16_MAX);
+}
+
+// Writes the value to the shared memory slot of the channel (see --shm),
+// the readers never block the writer (see “expression_pedal_shm.h”).
+// The blocked readers are woken up by the consumer (see “wait_for_values()”).
+static inline void publish_shm_value(State *state, const ValueUpdate *update)
+{
+  EpShm *shm = state->shm;
+  EpShmSlot *slot = &shm->channels[update->channel - 1];
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+  atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  atomic_store_explicit(&slot->value, update->value, memory_order_relaxed);
+  atomic_store_explicit(&slot->value16, update->value16, memory_order_relaxed);
+  atomic_store_explicit(&slot->position, update->position, memory_order_relaxed);
+  atomic_store_explicit(&slot->frame_time, update->frame_time, memory_order_relaxed);
+  atomic_store_explicit(
+    &slot->time_ns,
+    (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec,
+    memory_order_relaxed
+  );
+
+  atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+  atomic_fetch_add_explicit(&shm->generation, 1, memory_order_seq_cst);
+}
+
+// Sends a value update if the value (or the 16-bit value when it is needed)
+// has changed. “position” is only used for 16-bit updates.
+static inline void push_value_update
+( State          *state
+, Channel        *channel
+, jack_nframes_t frame_time
+, uint8_t        value
+, uint16_t       value16
+, float          position
+)
+{
+  if (
+    value != channel->last_value
+    || (state->high_resolution && value16 != channel->last_value16)
+  ) {
+    // On overflow the value is dropped (and counted), the last values are
+    // kept, so the next window sends it again.
+    ValueUpdate update = {
+      .channel       = channel->number,
+      .value         = value,
+      .value_changed = value != channel->last_value,
+      .value16       = value16,
+      .position      = state->high_resolution ? position : 0.0f,
+      .frame_time    = frame_time,
+    };
+
+    if (state->shm != NULL) publish_shm_value(state, &update);
+
+    if ( ! RING_PUSH(state->value_changes_ring, update)) {
+      // The same level would be skipped otherwise
+      channel->last_rms_db = NAN;
+      return;
+    }
+
+    // There is no consumer to wake up offline (see “run_offline()”)
+    if (state->values_event_fd != -1) eventfd_write(state->values_event_fd, 1);
+
+    channel->last_value = value;
+    channel->last_value16 = value16;
+  }
+}
+
+// Quantizes dB levels. It is the reference mapping of the levels to values,
+// “handle_mean_square()” uses it when the thresholds cannot be used
+// (smoothing, hysteresis or control signal need the unquantized level).
+void handle_rms_db
+( State          *state
+, Channel        *channel
+, jack_nframes_t offset
+, sample_t       rms_db
+)
+{
+  jack_nframes_t frame_time = state->period_frame_time + offset;
+
+  if (channel->one_euro_min_cutoff > 0.0f)
+    rms_db = filter_one_euro(state, channel, rms_db, frame_time);
+
+  if (rms_db == channel->last_rms_db) return;
+  channel->last_rms_db = rms_db;
+
+  sample_t scaled = scale_rms_db(channel, rms_db);
+  uint8_t value = quantize_scaled_value(scaled);
+  float position = rms_db_to_position(channel, rms_db);
+  uint16_t value16 = quantize_position(position);
+
+  if (channel->hysteresis > 0.0f) {
+    bool changed =
+      value != channel->last_value
+      || (state->high_resolution && value16 != channel->last_value16);
+
+    if (is_held_by_hysteresis(
+      scaled, value, channel->last_value, UINT8_MAX, channel->hysteresis
+    )) value = channel->last_value;
+
+    // Same width of the band in terms of the position
+    if (is_held_by_hysteresis(
+      (double)position * UINT16_MAX,
+      value16,
+      channel->last_value16,
+      UINT16_MAX,
+      channel->hysteresis * (UINT16_MAX / UINT8_MAX)
+    )) value16 = channel->last_value16;
+
+    if (
+      changed
+      && value == channel->last_value
+      && ( ! state->high_resolution || value16 == channel->last_value16)
+    ) atomic_fetch_add_explicit(&state->stats.suppressed, 1, memory_order_relaxed);
+  }
+
+  if (state->midi.enabled) handle_midi_value(state, channel, offset, value16);
+
+  // The new position is known after the last sample of the window
+  if (state->cv_output) {
+    render_cv(state, channel, offset + 1);
+    channel->cv_target = position;
+  }
+
+  push_value_update(state, channel, frame_time, value, value16, position);
+}
+
+// Value of the step the mean square falls into: the amount of thresholds
+// (starting from the second one, the first one is 0) the mean square is not
+// below. A branch-free binary search, “bits” steps of it.
+static inline unsigned int lookup_value
+( const sample_t *thresholds // 2^“bits” long, ascending
+, unsigned int   bits
+, sample_t       mean_square
+)
+{
+  unsigned int value = 0;
+
+  for (unsigned int step = 1u << (bits - 1); step != 0; step >>= 1)
+    value += (thresholds[value + step] <= mean_square) * step;
+
+  return value;
+}
+
+// Quantizes mean squares. Without smoothing, hysteresis and control signal
+// the values are looked up in the precalculated thresholds, the level is only
+// converted to dB when a 16-bit update carries the unquantized position.
+void handle_mean_square
+( State          *state
+, Channel        *channel
+, jack_nframes_t offset
+, sample_t       mean_square
+)
+{
+  if (channel->value_thresholds == NULL) {
+    handle_rms_db(state, channel, offset, AMP_TO_DB(mean_square));
+    return;
+  }
+
+  uint8_t value = lookup_value(channel->value_thresholds, 8, mean_square);
+  uint16_t value16 =
+    channel->value16_thresholds == NULL
+      ? 0
+      : lookup_value(channel->value16_thresholds, 16, mean_square);
+
+  if (state->midi.enabled) handle_midi_value(state, channel, offset, value16);
+
+  if (
+    value != channel->last_value
+    || (state->high_resolution && value16 != channel->last_value16)
+  ) push_value_update(
+    state,
+    channel,
+    state->period_frame_time + offset,
+    value,
+    value16,
+    state->high_resolution
+      ? rms_db_to_position(channel, AMP_TO_DB(mean_square))
+      : 0.0f
+  );
+}
+
+// Reference mapping of a mean square to the value (see “handle_rms_db()”).
+static unsigned int quantize_mean_square
+( const Channel  *channel
+, unsigned int   bits // 8 or 16
+, sample_t       mean_square
+)
+{
+  sample_t rms_db = AMP_TO_DB(mean_square);
+
+  return bits == 8
+    ? quantize_scaled_value(scale_rms_db(channel, rms_db))
+    : quantize_position(rms_db_to_position(channel, rms_db));
+}
+
+#define FLOAT_INFINITY_BITS 0x7F800000 // of positive infinity
+
+static inline sample_t float_from_bits(int64_t bits)
+{
+  uint32_t x = (uint32_t)bits;
+  sample_t f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+static inline int64_t float_bits(sample_t f)
+{
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+// The smallest mean square that is quantized to at least “value”.
+//
+// Non-negative floats are ordered the same way as their bit patterns,
+// so it is a search over the bits. It starts from an estimate (the middle
+// between the steps in dB) and gallops to bracket the exact threshold,
+// the reference mapping decides on every step, so the thresholds reproduce
+// it exactly, including rounding of the float math.
+static sample_t find_value_threshold
+( const Channel  *channel
+, unsigned int   bits
+, unsigned int   value
+)
+{
+  unsigned int max_value = (1u << bits) - 1;
+  double rms_db = channel->rms_bounds.rms_min_bound
+    + (value - 0.5) / max_value * channel->rms_bounds.rms_max_bound;
+  sample_t estimate = pow(10, rms_db / 20);
+
+  int64_t start = float_bits(estimate);
+  if (isnan(estimate) || start > FLOAT_INFINITY_BITS) start = FLOAT_INFINITY_BITS;
+
+  // Invariant: “lo” is below the threshold (-1 stands for below zero),
+  // “hi” is not (the infinity always is quantized to the max value).
+  int64_t lo, hi;
+
+  if (quantize_mean_square(channel, bits, float_from_bits(start)) >= value) {
+    hi = start;
+
+    for (int64_t step = 1;; step *= 2) {
+      lo = hi - step;
+      if (lo < 0) { lo = -1; break; }
+      if (quantize_mean_square(channel, bits, float_from_bits(lo)) < value) break;
+      hi = lo;
+    }
+  } else {
+    lo = start;
+
+    for (int64_t step = 1;; step *= 2) {
+      hi = lo + step;
+      if (hi >= FLOAT_INFINITY_BITS) { hi = FLOAT_INFINITY_BITS; break; }
+      if (quantize_mean_square(channel, bits, float_from_bits(hi)) >= value) break;
+      lo = hi;
+    }
+  }
+
+  while (hi - lo > 1) {
+    int64_t mid = lo + (hi - lo) / 2;
+
+    if (quantize_mean_square(channel, bits, float_from_bits(mid)) >= value)
+      hi = mid;
+    else
+      lo = mid;
+  }
+
+  return float_from_bits(hi);
+}
+
+static sample_t *build_value_thresholds(const Channel *channel, unsigned int bits)
+{
+  unsigned int count = 1u << bits;
+  sample_t *thresholds = malloc(sizeof(sample_t) * count);
+  MALLOC_CHECK(thresholds);
+
+  thresholds[0] = 0.0f; // never compared
+  for (unsigned int value = 1; value < count; ++value)
+    thresholds[value] = find_value_threshold(channel, bits, value);
+
+  return thresholds;
+}
+
+#ifdef DEBUG
+// Compares the looked up values with the reference mapping for every 2¹⁰th
+// float (all of the magnitudes, about two million comparisons) and right
+// at the thresholds.
+void check_value_thresholds(Channel *channel, unsigned int bits)
+{
+  const sample_t *thresholds =
+    bits == 8 ? channel->value_thresholds : channel->value16_thresholds;
+
+  for (int64_t x = 0; x <= FLOAT_INFINITY_BITS; x += 1 << 10) {
+    sample_t mean_square = float_from_bits(x);
+    unsigned int value = lookup_value(thresholds, bits, mean_square);
+    unsigned int reference = quantize_mean_square(channel, bits, mean_square);
+
+    if (value != reference)
+      ERR(
+        "%u-bit value of mean square %g of channel #%d is %u, expected %u!",
+        bits,
+        mean_square,
+        channel->number,
+        value,
+        reference
+      );
+  }
+
+  for (unsigned int value = 1; value < 1u << bits; ++value) {
+    int64_t x = float_bits(thresholds[value]);
+
+    if (
+      quantize_mean_square(channel, bits, thresholds[value]) < value
+      || (x > 0 && quantize_mean_square(channel, bits, float_from_bits(x - 1)) >= value)
+    )
+      ERR(
+        "Wrong %u-bit threshold %g of value %u of channel #%d!",
+        bits,
+        thresholds[value],
+        value,
+        channel->number
+      );
+  }
+
+  LOG("%u-bit value thresholds of channel #%d are correct", bits, channel->number);
+}
+#endif
+
+// Precalculates the mean squares at which the values step up, so
+// the realtime thread quantizes levels without any logarithm
+// (see “handle_mean_square()”), the response curve costs nothing there
+// either. Must be called after the outputs are
+// configured: the 16-bit thresholds (256 KiB) are only built when 16-bit
+// values or MIDI are needed. Channels with smoothing or hysteresis,
+// and the control signal output, need the dB levels, they are left without
+// thresholds.
+void init_channel_value_thresholds(State *state, Channel *channel)
+{
+  if (
+    state->cv_output
+    || channel->hysteresis > 0.0f
+    || channel->one_euro_min_cutoff > 0.0f
+  ) return;
+
+  LOG("Building value thresholds of channel #%d…", channel->number);
+  channel->value_thresholds = build_value_thresholds(channel, 8);
+#ifdef DEBUG
+  check_value_thresholds(channel, 8);
+#endif
+
+  if (state->high_resolution || state->midi.enabled) {
+    channel->value16_thresholds = build_value_thresholds(channel, 16);
+#ifdef DEBUG
+    check_value_thresholds(channel, 16);
+#endif
+  }
+}
+
+void init_value_thresholds(State *state)
+{
+  for (unsigned int i = 0; i < state->channels_count; ++i)
+    init_channel_value_thresholds(state, &state->channels[i]);
+}
+
+// Bank of Goertzel filters, one per tone. Every sample is windowed once
+// and then fed to all the filters of the group.
+static inline void process_goertzel_bank
+( ToneGroup      *group
+, const sample_t *buf
+, const sample_t *window
+, jack_nframes_t n
+)
+{
+  unsigned int tones_count = group->tones_count;
+  sample_t *coeff = group->coeff, *s1 = group->s1, *s2 = group->s2;
+
+  for (jack_nframes_t i = 0; i < n; ++i) {
+    sample_t x = buf[i] * window[i];
+
+    for (unsigned int k = 0; k < tones_count; ++k) {
+      sample_t s0 = x + coeff[k] * s1[k] - s2[k];
+      s2[k] = s1[k];
+      s1[k] = s0;
+    }
+  }
+}
+
+// Mixes the sine waves of all the channels of the group into the send port
+// and detects the level of every tone in the returned signal.
+//
+// Goertzel filter gives |X|² of the DFT bin of the tone. For a sine wave of
+// amplitude A it is (A·Σw/2)², so the mean square handed to the handler is
+// 2·|X|²/(Σw)², the same as the lock-in detector reports.
+static inline void process_tone_group
+( State          *state
+, ToneGroup      *group
+, sample_t       *send_buf
+, const sample_t *return_buf
+, jack_nframes_t nframes
+, RmsHandler     handler
+)
+{
+  Channel *channels = state->channels + group->first_channel;
+
+  render_sine_wave(&channels[0], send_buf, nframes);
+
+  for (unsigned int k = 1; k < group->tones_count; ++k) {
+    render_sine_wave(&channels[k], state->mix_buf, nframes);
+    for (jack_nframes_t i = 0; i < nframes; ++i)
+      send_buf[i] += state->mix_buf[i];
+  }
+
+  // Keep the mix within [-1; 1]
+  sample_t gain = 1.0f / group->tones_count;
+  for (jack_nframes_t i = 0; i < nframes; ++i) send_buf[i] *= gain;
+
+  for (jack_nframes_t i = 0, n = 0; i < nframes; i += n) {
+    n = MIN(
+      nframes - i,
+      group->window_size - MIN(group->window_sample_i, group->window_size)
+    );
+
+    process_goertzel_bank(
+      group,
+      return_buf + i,
+      group->window + group->window_sample_i,
+      n
+    );
+
+    group->window_sample_i += n;
+    if (group->window_sample_i < group->window_size) break;
+    group->window_sample_i = 0;
+
+    for (unsigned int k = 0; k < group->tones_count; ++k) {
+      sample_t s1 = group->s1[k], s2 = group->s2[k];
+      sample_t power = s1 * s1 + s2 * s2 - group->coeff[k] * s1 * s2;
+      sample_t mean_square
+        = 2 * power / (group->window_sum * group->window_sum);
+
+      group->s1[k] = 0.0f;
+      group->s2[k] = 0.0f;
+      handler(
+        state,
+        &channels[k],
+        i + n - 1,
+        finalize_mean_square(1, mean_square)
+      );
+    }
+  }
+}
+
+// Amount of send/return port pairs, a pair per channel or per group
+// of channels with frequency-division multiplexing.
+static inline unsigned int port_pairs_count(State *state)
+{
+  return state->tones_per_port > 1
+    ? state->tone_groups_count
+    : state->channels_count;
+}
+
+// The whole DSP of a single period: renders the sine waves to “send_bufs”
+// and detects the values from “return_bufs” (a buffer per port pair,
+// see “port_pairs_count()”). It does not touch JACK, so the same processing
+// runs offline and in the benchmarks (see “run_offline()”).
+// “frame_time” is the frame time of the first sample of the buffers.
+static inline void process_period
+( State          *state
+, jack_nframes_t frame_time
+, sample_t       **send_bufs
+, sample_t       **return_bufs
+, jack_nframes_t nframes
+, RmsHandler     handler
+)
+{
+  state->period_frame_time = frame_time;
+
+  if (state->tones_per_port > 1) {
+    for (unsigned int i = 0; i < state->tone_groups_count; ++i)
+      process_tone_group(
+        state,
+        &state->tone_groups[i],
+        send_bufs[i],
+        return_bufs[i],
+        nframes,
+        handler
+      );
+
+    return;
+  }
+
+  for (unsigned int i = 0; i < state->channels_count; ++i) {
+    Channel *channel = &state->channels[i];
+    jack_nframes_t phase = channel->sine_wave_sample_i;
+    render_sine_wave(channel, send_bufs[i], nframes);
+    process_detector(state, channel, return_bufs[i], nframes, phase, handler);
+  }
+}
+
+// Gets the buffers of the send/return port pairs for “process_period()”.
+static inline void get_port_buffers
+( State          *state
+, jack_nframes_t nframes
+, sample_t       **send_bufs
+, sample_t       **return_bufs
+)
+{
+  bool multiplexed = state->tones_per_port > 1;
+
+  for (unsigned int i = 0; i < port_pairs_count(state); ++i) {
+    jack_port_t *send_port = multiplexed
+      ? state->tone_groups[i].send_port
+      : state->channels[i].send_port;
+    jack_port_t *return_port = multiplexed
+      ? state->tone_groups[i].return_port
+      : state->channels[i].return_port;
+
+    send_bufs[i] = jack_port_get_buffer(send_port, nframes);
+    return_bufs[i] = jack_port_get_buffer(return_port, nframes);
+  }
+}
+
+static inline double elapsed_ns(struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) * 1e9 + (to->tv_nsec - from->tv_nsec);
+}
+
+// Records the time the process callback took and the depth of the ring
+// it pushes to. “clock_gettime()” with “CLOCK_MONOTONIC” is served by vDSO,
+// without a syscall, so it is fine for the realtime thread.
+static inline void record_rt_stats
+( State           *state
+, struct timespec *start
+, jack_nframes_t  nframes
+, size_t          ring_depth
+)
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  RtStats *stats = &state->stats;
+
+  unsigned long long busy = elapsed_ns(start, &end);
+  unsigned long long period =
+    (unsigned long long)nframes * 1000000000 / state->sample_rate;
+  unsigned long long bucket = period == 0 ? 0 : busy * 10 / period;
+
+  atomic_fetch_add_explicit(&stats->callbacks, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&stats->busy_ns, busy, memory_order_relaxed);
+  atomic_fetch_add_explicit(&stats->period_ns, period, memory_order_relaxed);
+  atomic_fetch_add_explicit(
+    &stats->load_histogram[MIN(bucket, RT_STATS_LOAD_BUCKETS - 1)],
+    1,
+    memory_order_relaxed
+  );
+  ATOMIC_STORE_MAX(stats->max_ns, busy);
+  ATOMIC_STORE_MAX(stats->max_ring_depth, ring_depth);
+}
+
+#define SWAP(a, b) \
+  { \
+    __typeof__(a) tmp = (a); \
+    (a) = (b); \
+    (b) = tmp; \
+  }
+
+// Adopts the configurations prepared by the control thread
+// (see “reload_channel()”). Only pointers and plain fields are swapped,
+// nothing is allocated or freed here.
+static inline void adopt_channel_reloads(State *state)
+{
+  for (unsigned int i = 0; i < state->channels_count; ++i) {
+    if (
+      atomic_load_explicit(&state->pending_reloads[i], memory_order_relaxed)
+        == NULL
+    ) continue;
+
+    ChannelReload *reload = atomic_exchange_explicit(
+      &state->pending_reloads[i],
+      NULL,
+      memory_order_acquire
+    );
+
+    if (reload == NULL) continue; // taken back by the control thread
+
+    Channel *channel = &state->channels[i], *next = &reload->channel;
+    SWAP(channel->rms_bounds, next->rms_bounds);
+    SWAP(channel->curve_table, next->curve_table);
+    SWAP(channel->value_thresholds, next->value_thresholds);
+    SWAP(channel->value16_thresholds, next->value16_thresholds);
+
+    if ( ! reload->keep_signal) {
+      SWAP(channel->sine_wave_freq, next->sine_wave_freq);
+      SWAP(channel->sine_wave_sample_i, next->sine_wave_sample_i);
+      SWAP(
+        channel->sine_wave_one_rotation_samples,
+        next->sine_wave_one_rotation_samples
+      );
+      SWAP(channel->oscillator, next->oscillator);
+      SWAP(
+        channel->use_default_rms_window_size,
+        next->use_default_rms_window_size
+      );
+      SWAP(channel->rms_window_size, next->rms_window_size);
+      SWAP(channel->rms_window_sample_i, next->rms_window_sample_i);
+      SWAP(channel->rms_sum, next->rms_sum);
+      SWAP(channel->rms_history, next->rms_history);
+      SWAP(channel->rms_hop_size, next->rms_hop_size);
+      SWAP(channel->rms_hop_sample_i, next->rms_hop_sample_i);
+      SWAP(channel->lockin_sin, next->lockin_sin);
+      SWAP(channel->lockin_cos, next->lockin_cos);
+      SWAP(channel->lockin_i_sum, next->lockin_i_sum);
+      SWAP(channel->lockin_q_sum, next->lockin_q_sum);
+    }
+
+    // The same level must give a new value with the new bounds
+    channel->last_rms_db = NAN;
+
+    atomic_store_explicit(&state->retired_reloads[i], reload, memory_order_release);
+  }
+}
+
+// JACK calls the sample rate and the buffer size callbacks from its own
+// (non-realtime) thread, the process callback of an active client may run
+// at the same time. The tables and the buffers are rebuilt only while
+// the processing is paused, so nothing the realtime thread reads is freed
+// under it. Dekker-style handshake: the realtime thread marks the period
+// as running and then checks for the pause, the other thread requests
+// the pause and then waits for the running period to end. Both sides use
+// sequentially consistent operations, so at least one of them sees the other.
+
+// Called first by the process callbacks, false when the period is skipped
+// (see “skip_period()”).
+static inline bool enter_period(State *state)
+{
+  atomic_store(&state->is_processing, true);
+  if ( ! atomic_load(&state->is_paused)) return true;
+  atomic_store(&state->is_processing, false);
+  return false;
+}
+
+static inline void leave_period(State *state)
+{
+  atomic_store_explicit(&state->is_processing, false, memory_order_release);
+}
+
+// Outputs silence for the period (only the ports are touched, they stay
+// registered while the processing is paused).
+static inline void skip_period(State *state, jack_nframes_t nframes)
+{
+  sample_t *send_bufs[MAX_CHANNELS], *return_bufs[MAX_CHANNELS];
+  get_port_buffers(state, nframes, send_bufs, return_bufs);
+
+  for (unsigned int i = 0; i < port_pairs_count(state); ++i)
+    memset(send_bufs[i], 0, sizeof(sample_t) * nframes);
+
+  for (unsigned int i = 0; state->cv_output && i < state->channels_count; ++i)
+    memset(
+      jack_port_get_buffer(state->channels[i].cv_port, nframes),
+      0,
+      sizeof(sample_t) * nframes
+    );
+
+  if (state->midi.enabled)
+    jack_midi_clear_buffer(jack_port_get_buffer(state->midi_port, nframes));
+}
+
+// Waits for the running period to end, the next ones are skipped until
+// “resume_processing()”. Not for the realtime thread. Returns right away
+// when the client is not active (nothing is processing).
+static void pause_processing(State *state)
+{
+  atomic_store(&state->is_paused, true);
+
+  while (atomic_load(&state->is_processing)) {
+    struct timespec delay = { 0, 100000 }; // 0.1 ms, a period is longer
+    nanosleep(&delay, NULL);
+  }
+}
+
+static void resume_processing(State *state)
+{
+  atomic_store(&state->is_paused, false);
+}
+
+int jack_process(jack_nframes_t nframes, void *arg)
+{
+  State *state = (State *)arg;
+
+  if ( ! enter_period(state)) {
+    skip_period(state, nframes);
+    return 0;
+  }
+
+  struct timespec start;
+  if (state->stats_interval != 0) clock_gettime(CLOCK_MONOTONIC, &start);
+  if (state->control != NULL) adopt_channel_reloads(state);
+
+  sample_t *send_bufs[MAX_CHANNELS], *return_bufs[MAX_CHANNELS];
+  get_port_buffers(state, nframes, send_bufs, return_bufs);
+
+  for (unsigned int i = 0; state->cv_output && i < state->channels_count; ++i) {
+    Channel *channel = &state->channels[i];
+    channel->cv_buf = jack_port_get_buffer(channel->cv_port, nframes);
+    channel->cv_sample_i = 0;
+  }
+
+  process_period(
+    state,
+    jack_last_frame_time(state->jack_client),
+    send_bufs,
+    return_bufs,
+    nframes,
+    handle_mean_square
+  );
+
+  for (unsigned int i = 0; state->cv_output && i < state->channels_count; ++i)
+    render_cv(state, &state->channels[i], nframes);
+
+  if (state->midi.enabled) write_midi_events(state, nframes);
+
+  if (state->stats_interval != 0)
+    record_rt_stats(
+      state,
+      &start,
+      nframes,
+      RING_DEPTH(state->value_changes_ring)
+    );
+
+  leave_period(state);
+  return 0;
+}
+
+// Length of the blocks of the calibration statistics (see “CalibrationStats”).
+#define CALIBRATION_BLOCK_MS 100
+
+// Accumulates the levels, publishes the mean and the variance of the block
+// when it is over. Realtime-safe: no allocation, no locks.
+static inline void update_calibration_stats
+( State          *state
+, CalibrationStats *stats
+, jack_nframes_t frame_time
+, sample_t       rms_db
+)
+{
+  if ( ! isfinite(rms_db)) return; // silence
+
+  if ( ! stats->is_started) {
+    stats->is_started = true;
+    stats->block_start = frame_time;
+  }
+
+  stats->count += 1;
+  stats->sum += rms_db;
+  stats->sum_of_squares += (double)rms_db * rms_db;
+
+  if (
+    frame_time - stats->block_start
+      >= state->sample_rate / (1000 / CALIBRATION_BLOCK_MS)
+  ) {
+    double mean = stats->sum / stats->count;
+    double variance = stats->sum_of_squares / stats->count - mean * mean;
+    atomic_store_explicit(&stats->block_mean, mean, memory_order_relaxed);
+    atomic_store_explicit(
+      &stats->block_variance,
+      MAX(variance, 0.0),
+      memory_order_relaxed
+    );
+
+    stats->block_start = frame_time;
+    stats->count = 0;
+    stats->sum = 0.0;
+    stats->sum_of_squares = 0.0;
+  }
+
+  // Single writer, so plain load and store
+  if (rms_db < atomic_load_explicit(&stats->min, memory_order_relaxed))
+    atomic_store_explicit(&stats->min, rms_db, memory_order_relaxed);
+  if (rms_db > atomic_load_explicit(&stats->max, memory_order_relaxed))
+    atomic_store_explicit(&stats->max, rms_db, memory_order_relaxed);
+}
+
+void handle_calibrate_mean_square
+( State          *state
+, Channel        *channel
+, jack_nframes_t offset
+, sample_t       mean_square
+)
+{
+  sample_t rms_db = AMP_TO_DB(mean_square);
+
+  update_calibration_stats(
+    state,
+    &state->calibration_stats[channel->number - 1],
+    state->period_frame_time + offset,
+    rms_db
+  );
+
+  if (state->auto_calibration || rms_db == channel->last_rms_db) return;
+  // On overflow the level is dropped (and counted), “last_rms_db” is kept,
+  // so the next window sends it again.
+  DecibelsUpdate update = { channel->number, rms_db };
+  if ( ! RING_PUSH(state->calibration_values_ring, update)) return;
+  if (state->values_event_fd != -1) eventfd_write(state->values_event_fd, 1);
+  channel->last_rms_db = rms_db;
+}
+
+int jack_process_calibrate(jack_nframes_t nframes, void *arg)
+{
+  State *state = (State *)arg;
+
+  if ( ! enter_period(state)) {
+    skip_period(state, nframes);
+    return 0;
+  }
+
+  struct timespec start;
+  if (state->stats_interval != 0) clock_gettime(CLOCK_MONOTONIC, &start);
+
+  sample_t *send_bufs[MAX_CHANNELS], *return_bufs[MAX_CHANNELS];
+  get_port_buffers(state, nframes, send_bufs, return_bufs);
+
+  process_period(
+    state,
+    jack_last_frame_time(state->jack_client),
+    send_bufs,
+    return_bufs,
+    nframes,
+    handle_calibrate_mean_square
+  );
+
+  if (state->stats_interval != 0)
+    record_rt_stats(
+      state,
+      &start,
+      nframes,
+      RING_DEPTH(state->calibration_values_ring)
+    );
+
+  leave_period(state);
+  return 0;
+}
+
+int handle_xrun(void *arg)
+{
+  State *state = (State *)arg;
+  atomic_fetch_add_explicit(&state->stats.xruns, 1, memory_order_relaxed);
+  return 0;
+}
+
+// Periodically prints the realtime stats to stderr (see “--stats”).
+// Maximums are reset after every report, the rest is cumulative.
+void* report_stats_loop(void *arg)
+{
+  State *state = (State *)arg;
+  RtStats *stats = &state->stats;
+
+  for (;;) {
+    if (wait_for_shutdown(-1, state->stats_interval * 1000)) return NULL;
+
+    unsigned long long callbacks =
+      atomic_load_explicit(&stats->callbacks, memory_order_relaxed);
+    unsigned long long busy_ns =
+      atomic_load_explicit(&stats->busy_ns, memory_order_relaxed);
+    unsigned long long period_ns =
+      atomic_load_explicit(&stats->period_ns, memory_order_relaxed);
+    unsigned long long max_ns =
+      atomic_exchange_explicit(&stats->max_ns, 0, memory_order_relaxed);
+    size_t max_ring_depth =
+      atomic_exchange_explicit(&stats->max_ring_depth, 0, memory_order_relaxed);
+
+    fprintf(
+      stderr,
+      "Stats: %llu callback(s), buffer size: %d, load: %.1f%% mean, "
+      "%.1f µs max (%.1f%% of the period), xruns: %u\n",
+      callbacks,
+      state->buffer_size,
+      period_ns == 0 ? 0.0 : busy_ns * 100.0 / period_ns,
+      max_ns / 1000.0,
+      state->sample_rate == 0
+        ? 0.0
+        : max_ns * 100.0 * state->sample_rate / state->buffer_size / 1e9,
+      atomic_load_explicit(&stats->xruns, memory_order_relaxed)
+    );
+
+    fprintf(stderr, "Stats: load histogram:");
+
+    for (unsigned int i = 0; i < RT_STATS_LOAD_BUCKETS; ++i) {
+      unsigned long long count =
+        atomic_load_explicit(&stats->load_histogram[i], memory_order_relaxed);
+      if (count == 0) continue;
+
+      if (i == RT_STATS_LOAD_BUCKETS - 1)
+        fprintf(stderr, " >100%%: %llu", count);
+      else
+        fprintf(stderr, " %u-%u%%: %llu", i * 10, i * 10 + 10, count);
+    }
+
+    fprintf(
+      stderr,
+      "\nStats: max ring depth: %zu/%zu, dropped: %u value update(s), "
+      "%u MIDI event(s), suppressed by hysteresis: %llu value update(s)\n",
+      max_ring_depth,
+      (size_t)VALUE_RING_SIZE,
+      atomic_load_explicit(
+        &state->value_changes_ring.overflows,
+        memory_order_relaxed
+      ) + atomic_load_explicit(
+        &state->calibration_values_ring.overflows,
+        memory_order_relaxed
+      ),
+      atomic_load_explicit(&stats->midi_dropped, memory_order_relaxed),
+      atomic_load_explicit(&stats->suppressed, memory_order_relaxed)
+    );
+
+    fprintf(
+      stderr,
+      "Stats: delivery latency: p50 < %llu µs, p99 < %llu µs, max %llu µs\n",
+      delivery_latency_percentile(stats, 50),
+      delivery_latency_percentile(stats, 99),
+      atomic_exchange_explicit(
+        &stats->max_delivery_latency_us,
+        0,
+        memory_order_relaxed
+      )
+    );
+  }
+
+  return NULL;
+}
+
+void register_ports(State *state)
+{
+  // With frequency-division multiplexing a port pair is registered per group
+  // of channels.
+  bool multiplexed = state->tones_per_port > 1;
+  unsigned int ports_count = port_pairs_count(state);
+
+  for (unsigned int i = 0; i < ports_count; ++i) {
+    Channel *channel =
+      &state->channels[multiplexed ? state->tone_groups[i].first_channel : i];
+
+    // A single pair of ports keeps the original names.
+    char send_port_name[sizeof("send_255")] = "send";
+    char return_port_name[sizeof("return_255")] = "return";
+
+    if (ports_count > 1) {
+      sprintf(send_port_name, "send_%d", i + 1);
+      sprintf(return_port_name, "return_%d", i + 1);
+    }
+
+    LOG("Registering JACK “%s” port…", send_port_name);
+
+    channel->send_port = jack_port_register( state->jack_client
+                                           , send_port_name
+                                           , JACK_DEFAULT_AUDIO_TYPE
+                                           , JackPortIsOutput
+                                           , 0
+                                           );
+
+    if (channel->send_port == NULL)
+      ERRJACK("Registering “%s” port failed!", send_port_name);
+
+    LOG("JACK “%s” port is registered.", send_port_name);
+    LOG("Registering JACK “%s” port…", return_port_name);
+
+    channel->return_port = jack_port_register( state->jack_client
+                                             , return_port_name
+                                             , JACK_DEFAULT_AUDIO_TYPE
+                                             , JackPortIsInput
+                                             , 0
+                                             );
+
+    if (channel->return_port == NULL)
+      ERRJACK("Registering “%s” port failed!", return_port_name);
+
+    LOG("JACK “%s” port is registered.", return_port_name);
+
+    if (multiplexed) {
+      ToneGroup *group = &state->tone_groups[i];
+      group->send_port = channel->send_port;
+      group->return_port = channel->return_port;
+
+      for (unsigned int k = 1; k < group->tones_count; ++k) {
+        channel[k].send_port = channel->send_port;
+        channel[k].return_port = channel->return_port;
+      }
+    }
+  }
+
+  for (unsigned int i = 0; state->cv_output && i < state->channels_count; ++i) {
+    Channel *channel = &state->channels[i];
+    char port_name[sizeof("cv_255")] = "cv";
+    if (state->channels_count > 1) sprintf(port_name, "cv_%d", channel->number);
+    LOG("Registering JACK “%s” port…", port_name);
+
+    channel->cv_port = jack_port_register( state->jack_client
+                                         , port_name
+                                         , JACK_DEFAULT_AUDIO_TYPE
+                                         , JackPortIsOutput
+                                         , 0
+                                         );
+
+    if (channel->cv_port == NULL)
+      ERRJACK("Registering “%s” port failed!", port_name);
+
+    LOG("JACK “%s” port is registered.", port_name);
+  }
+
+  if (state->midi.enabled) {
+    LOG("Registering JACK “midi_out” port…");
+
+    state->midi_port = jack_port_register( state->jack_client
+                                         , "midi_out"
+                                         , JACK_DEFAULT_MIDI_TYPE
+                                         , JackPortIsOutput
+                                         , 0
+                                         );
+
+    if (state->midi_port == NULL)
+      ERRJACK("Registering “midi_out” port failed!");
+
+    LOG("JACK “midi_out” port is registered.");
+  }
+}
+
+// (Re)initializes the channel for the sample rate.
+// Must not be called from the realtime thread (it allocates).
+void init_channel(Channel *channel, jack_nframes_t sample_rate)
+{
+  channel->sample_rate = sample_rate;
+
+  channel->sine_wave_one_rotation_samples = round(
+    (sample_t)channel->sample_rate / channel->sine_wave_freq
+  );
+
+  if (channel->use_default_rms_window_size) {
+    channel->rms_window_size = channel->sine_wave_one_rotation_samples;
+    LOG(
+      "New RMS window size of channel #%d: %d samples",
+      channel->number,
+      channel->rms_window_size
+    );
+  }
+
+  init_oscillator(channel);
+  init_detector(channel);
+}
+
+// Amount of rotations of the longest sine wave of the group in the default
+// integration window of frequency-division multiplexing. Longer window gives
+// better separation of the tones (narrower Goertzel filters) but adds latency.
+#define TONE_GROUP_DEFAULT_WINDOW_ROTATIONS 8
+
+// (Re)initializes the Goertzel filter bank of the group for the sample rate.
+// Channels of the group must be initialized first (see “init_channel()”).
+// Must not be called from the realtime thread (it allocates).
+void init_tone_group(State *state, ToneGroup *group)
+{
+  Channel *channels = state->channels + group->first_channel;
+  sample_t *old_window = group->window;
+
+  // The window is shared, so the longest requested window is used.
+  group->window_size = 0;
+
+  for (unsigned int k = 0; k < group->tones_count; ++k) {
+    jack_nframes_t window_size =
+      channels[k].use_default_rms_window_size
+        ? channels[k].sine_wave_one_rotation_samples
+          * TONE_GROUP_DEFAULT_WINDOW_ROTATIONS
+        : channels[k].rms_window_size;
+
+    group->window_size = MAX(group->window_size, window_size);
+  }
+
+  LOG(
+    "Building Goertzel filter bank of %d tones with a window of %d samples…",
+    group->tones_count,
+    group->window_size
+  );
+
+  sample_t *window = malloc(sizeof(sample_t) * group->window_size);
+  MALLOC_CHECK(window);
+  group->window_sum = 0.0f;
+
+  for (jack_nframes_t i = 0; i < group->window_size; ++i) {
+    window[i] = 0.5f - 0.5f * cos(2 * M_PI * i / group->window_size);
+    group->window_sum += window[i];
+  }
+
+  for (unsigned int k = 0; k < group->tones_count; ++k) {
+    // Frequency of the sent sine wave is what fits into its rotation
+    // (the rotation is rounded to whole samples).
+    group->coeff[k] =
+      2 * cos(2 * M_PI / channels[k].sine_wave_one_rotation_samples);
+    group->s1[k] = 0.0f;
+    group->s2[k] = 0.0f;
+  }
+
+  group->window = window;
+  group->window_sample_i = 0;
+  free(old_window);
+}
+
+int set_sample_rate(jack_nframes_t nframes, void *arg)
+{
+  State *state = (State *)arg;
+  LOG("New JACK sample rate received: %d", nframes);
+
+  // The old tables are freed (see “init_oscillator()”, “init_detector()”
+  // and “init_tone_group()”), see “enter_period()”.
+  pause_processing(state);
+  state->sample_rate = nframes;
+
+  for (unsigned int i = 0; i < state->channels_count; ++i)
+    init_channel(&state->channels[i], state->sample_rate);
+
+  for (unsigned int i = 0; i < state->tone_groups_count; ++i)
+    init_tone_group(state, &state->tone_groups[i]);
+
+  state->cv_coeff =
+    state->cv_smoothing > 0.0f
+    ? 1.0f - expf(-1.0f / (state->cv_smoothing * state->sample_rate))
+    : 1.0f;
+
+  resume_processing(state);
+  return 0;
+}
+
+int set_buffer_size(jack_nframes_t nframes, void *arg)
+{
+  State *state = (State *)arg;
+  LOG("New JACK buffer size: %d", nframes);
+
+  // The old mixing buffer is freed, see “enter_period()”
+  pause_processing(state);
+  state->buffer_size = nframes;
+
+  if (state->tones_per_port > 1) {
+    sample_t *old_mix_buf = state->mix_buf;
+    sample_t *mix_buf = malloc(sizeof(sample_t) * nframes);
+    MALLOC_CHECK(mix_buf);
+    state->mix_buf = mix_buf;
+    free(old_mix_buf);
+  }
+
+  resume_processing(state);
+  return 0;
+}
+
+void bind_callbacks(State *state, bool calibrate)
+{
+  if (calibrate) {
+    LOG("Binding JACK process callback for calibration mode…");
+
+    if (jack_set_process_callback(
+      state->jack_client,
+      jack_process_calibrate,
+      (void *)state
+    )) ERRJACK("jack_set_process_callback() error!");
+
+    LOG("JACK process callback for calibration mode is bound.");
+  } else {
+    LOG("Binding JACK process callback…");
+
+    if (jack_set_process_callback(
+      state->jack_client,
+      jack_process,
+      (void *)state
+    )) ERRJACK("jack_set_process_callback() error!");
+
+    LOG("JACK process callback is bound.");
+  }
+
+  LOG("Binding JACK sample rate callback…");
+
+  if (jack_set_sample_rate_callback(
+    state->jack_client,
+    set_sample_rate,
+    (void *)state
+  ) != 0) ERRJACK("jack_set_sample_rate_callback() error!");
+
+  LOG("JACK sample rate callback is bound.");
+
+  LOG("Binding JACK buffer size callback…");
+
+  if (jack_set_buffer_size_callback(
+    state->jack_client,
+    set_buffer_size,
+    (void *)state
+  ) != 0) ERRJACK("jack_set_buffer_size_callback() error!");
+
+  LOG("JACK buffer size callback is bound.");
+
+  LOG("Binding JACK xrun callback…");
+
+  if (jack_set_xrun_callback(
+    state->jack_client,
+    handle_xrun,
+    (void *)state
+  ) != 0) ERRJACK("jack_set_xrun_callback() error!");
+
+  LOG("JACK xrun callback is bound.");
+}
+
+// If stopping takes longer (for instance JACK server does not respond or
+// stdout is not read), the process exits anyway on “SIGALRM”.
+#define SHUTDOWN_TIMEOUT_S 5
+
+void shutdown_timeout_handler(int signum)
+{
+  static const char message[] =
+    "ERROR: The app did not stop in time, exiting anyway!\n";
+
+  ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+  (void)written;
+  _exit(EXIT_FAILURE);
+}
+
+// Stops the app once the shutdown is requested (see “request_shutdown()”),
+// must be called from the main thread. The threads watch the shutdown pipe
+// and stop on their own, here they are just joined.
+void terminate_app(State *state)
+{
+  fprintf(stderr, "Terminating the app…\n");
+  signal(SIGALRM, shutdown_timeout_handler);
+  alarm(SHUTDOWN_TIMEOUT_S);
+  bool jack_is_down = atomic_load(&shutdown_request.jack_is_down);
+
+  if ( ! jack_is_down) {
+    // The JACK thread stops pushing the values and adopting reloads
+    LOG("Deactivating JACK client…");
+
+    if (jack_deactivate(state->jack_client) != 0)
+      ERRJACK("JACK client deactivation failed!");
+  }
+
+  if (state->has_session) {
+    LOG("Waiting for calibration session thread to stop…");
+    pthread_join(state->session_tid, NULL);
+  }
+
+  LOG("Waiting for value updates handling thread to stop…");
+  pthread_join(state->consumer_tid, NULL);
+
+  if (state->stats_interval != 0) {
+    LOG("Waiting for realtime stats reporting thread to stop…");
+    pthread_join(state->stats_tid, NULL);
+  }
+
+  if (state->server_socket_fd != -1) {
+    // Client connections are closed by the socket server thread
+    LOG("Closing socket server (FD: %d)…", state->server_socket_fd);
+
+    if (close(state->server_socket_fd) < 0) PERR(
+      "Failed to close socket server (FD: %d)",
+      state->server_socket_fd
+    );
+
+    LOG("Closing epoll instance (FD: %d)…", state->epoll_fd);
+
+    if (close(state->epoll_fd) < 0) PERR(
+      "Failed to close epoll instance (FD: %d)",
+      state->epoll_fd
+    );
+  }
+
+  if (state->shm != NULL) {
+    LOG("Removing shared memory segment “%s”…", state->shm_name);
+    shm_unlink(state->shm_name);
+  }
+
+  if (state->control != NULL) {
+    LOG("Waiting for control thread to stop…");
+    pthread_join(state->control->tid, NULL);
+    LOG("Removing control socket “%s”…", state->control->path);
+    close(state->control->socket_fd);
+    unlink(state->control->path);
+  }
+
+  if ( ! jack_is_down) {
+    LOG("Closing JACK client…");
+
+    if (jack_client_close(state->jack_client) != 0)
+      ERRJACK("Closing JACK client failed!");
+
+    // Only when the JACK thread is stopped, it writes to the eventfd.
+    LOG("Closing value updates eventfd…");
+    close(state->values_event_fd);
+  }
+
+  alarm(0);
+  LOG("DONE!");
+}
+
+// Called from a JACK thread, so the app is stopped by the main thread.
+void jack_shutdown_callback()
+{
+  request_shutdown(true);
+}
+
+// Only async-signal-safe calls here. Ctrl+C pressed again while the app is
+// stopping kills it right away. Other repeated signals are ignored (“timeout”
+// or a supervisor may send SIGTERM to the whole process group more than
+// once), the cleanup is bounded anyway (see “SHUTDOWN_TIMEOUT_S”).
+void sig_handler(int signum)
+{
+  if ( ! shutdown_request.is_requested) request_shutdown(false);
+  else if (signum == SIGINT) _exit(128 + signum);
+}
+
+void null_channel(Channel *channel)
+{
+  channel->number      = 0;
+  channel->send_port   = NULL;
+  channel->return_port = NULL;
+  channel->sample_rate = 0;
+
+  channel->last_value = 0;
+  channel->last_value16 = 0;
+
+  channel->value_thresholds   = NULL;
+  channel->value16_thresholds = NULL;
+
+  channel->curve              = CURVE_LINEAR;
+  channel->curve_points.count = 0;
+  channel->curve_table        = NULL;
+
+  channel->midi_cc         = 0;
+  channel->last_midi_value = MIDI_VALUE_NONE;
+
+  channel->cv_port     = NULL;
+  channel->cv_buf      = NULL;
+  channel->cv_sample_i = 0;
+  channel->cv_value    = 0.0f;
+  channel->cv_target   = 0.0f;
+
+  channel->sine_wave_freq                 = 0.0f;
+  channel->sine_wave_sample_i             = 0;
+  channel->sine_wave_one_rotation_samples = 0;
+
+  channel->oscillator.type        = OSCILLATOR_WAVETABLE;
+  channel->oscillator.wavetable   = NULL;
+  channel->oscillator.phasor_re   = 1.0;
+  channel->oscillator.phasor_im   = 0.0;
+  channel->oscillator.rotation_re = 1.0;
+  channel->oscillator.rotation_im = 0.0;
+
+  RmsBounds rms_bounds                 = { 0.0f, 0.0f };
+  channel->rms_bounds                  = rms_bounds;
+  channel->use_default_rms_window_size = false;
+  channel->rms_window_size             = 0;
+  channel->rms_window_sample_i         = 0;
+  channel->rms_sum                     = 0.0f;
+  channel->last_rms_db                 = 0.0f;
+  channel->rms_mode                    = RMS_MODE_TUMBLING;
+
+  channel->hysteresis          = 0.0f;
+  channel->one_euro_min_cutoff = 0.0f;
+  channel->one_euro_beta       = 0.0f;
+  channel->one_euro_primed     = false;
+  channel->one_euro_value      = 0.0f;
+  channel->one_euro_slope      = 0.0f;
+  channel->one_euro_frame_time = 0;
+
+  channel->rms_history              = NULL;
+  channel->use_default_rms_hop_size = false;
+  channel->rms_hop_size             = 0;
+  channel->rms_hop_sample_i         = 0;
+
+  channel->detector     = DETECTOR_RMS;
+  channel->lockin_sin   = NULL;
+  channel->lockin_cos   = NULL;
+  channel->lockin_i_sum = 0.0f;
+  channel->lockin_q_sum = 0.0f;
+}
+
+void free_channel(Channel *channel)
+{
+  free(channel->oscillator.wavetable);
+  free(channel->rms_history);
+  free(channel->lockin_sin);
+  free(channel->lockin_cos);
+  free(channel->value_thresholds);
+  free(channel->value16_thresholds);
+  free(channel->curve_table);
+  channel->oscillator.wavetable = NULL;
+  channel->rms_history          = NULL;
+  channel->lockin_sin           = NULL;
+  channel->lockin_cos           = NULL;
+  channel->value_thresholds     = NULL;
+  channel->value16_thresholds   = NULL;
+  channel->curve_table          = NULL;
+}
+
+void null_state(State *state)
+{
+  state->sample_rate = 0;
+  state->buffer_size = 0;
+
+  state->jack_client = NULL;
+  state->period_frame_time = 0;
+
+  for (unsigned int i = 0; i < MAX_CHANNELS; ++i)
+    null_channel(&state->channels[i]);
+  state->channels_count = 0;
+
+  state->tones_per_port    = 1;
+  state->tone_groups_count = 0;
+  state->mix_buf           = NULL;
+  memset(&state->tone_groups, 0, sizeof(state->tone_groups));
+
+  state->output_format = OUTPUT_FORMAT_TEXT;
+  state->high_resolution = false;
+
+  state->values_event_fd = -1;
+  memset(&state->value_changes_ring, 0, sizeof(ValueUpdateRing));
+  memset(&state->calibration_values_ring, 0, sizeof(DecibelsUpdateRing));
+  for (unsigned int i = 0; i < MAX_CHANNELS; ++i)
+    atomic_init(&state->calibration_levels[i], NAN);
+
+  state->auto_calibration = false;
+
+  for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+    CalibrationStats *stats = &state->calibration_stats[i];
+    stats->is_started = false;
+    stats->block_start = 0;
+    stats->count = 0;
+    stats->sum = 0.0;
+    stats->sum_of_squares = 0.0;
+    atomic_init(&stats->block_mean, NAN);
+    atomic_init(&stats->block_variance, NAN);
+    atomic_init(&stats->min, INFINITY);
+    atomic_init(&stats->max, -INFINITY);
+  }
+
+  state->server_socket_fd = -1;
+  state->socket_connections = NULL;
+  state->epoll_fd = -1;
+  state->delivery_policy = DEFAULT_DELIVERY_POLICY;
+  state->max_clients = DEFAULT_MAX_CLIENTS;
+  state->connection_pool = NULL;
+  state->queue_pool = NULL;
+  state->queue_slot_capacity = 0;
+  state->free_connections = NULL;
+  state->accept_backoff_ms = 0;
+  state->accept_resume_ms = 0;
+
+  state->udp_socket_fd = -1;
+  memset(&state->udp_address, 0, sizeof(state->udp_address));
+  state->udp_sequence = 0;
+
+  state->midi = (MidiOutput) { false, 0, false };
+  state->midi_port = NULL;
+  state->midi_events_count = 0;
+
+  state->cv_output = false;
+  state->cv_smoothing = 0.0f;
+  state->cv_coeff = 1.0f;
+
+  state->stats_interval = 0;
+  atomic_init(&state->stats.callbacks, 0);
+  atomic_init(&state->stats.busy_ns, 0);
+  atomic_init(&state->stats.period_ns, 0);
+  atomic_init(&state->stats.max_ns, 0);
+  for (unsigned int i = 0; i < RT_STATS_LOAD_BUCKETS; ++i)
+    atomic_init(&state->stats.load_histogram[i], 0);
+  atomic_init(&state->stats.xruns, 0);
+  atomic_init(&state->stats.max_ring_depth, 0);
+  atomic_init(&state->stats.midi_dropped, 0);
+  atomic_init(&state->stats.suppressed, 0);
+  for (unsigned int i = 0; i < DELIVERY_LATENCY_BUCKETS; ++i)
+    atomic_init(&state->stats.delivery_latency[i], 0);
+  atomic_init(&state->stats.max_delivery_latency_us, 0);
+  state->frames_epoch_us = 0;
+  atomic_init(&state->is_stopping, false);
+
+  state->control = NULL;
+  state->shm = NULL;
+  state->shm_name = NULL;
+
+  memset(&state->realtime, 0, sizeof(RealtimeSetup));
+  state->jack_priority = -1;
+  state->has_session = false;
+
+  for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+    atomic_init(&state->pending_reloads[i], NULL);
+    atomic_init(&state->retired_reloads[i], NULL);
+  }
+
+  atomic_init(&state->is_paused, false);
+  atomic_init(&state->is_processing, false);
+}
+
+// Allocates a state with the configured channels (see “null_channel()”).
+// Sample rate and buffer size are set later (see “set_sample_rate()”
+// and “set_buffer_size()”), the rings are up to the caller.
+State *new_state
+( Channel        *channels
+, unsigned int   channels_count
+, unsigned int   tones_per_port
+)
+{
+  State *state = (State *)malloc(sizeof(State));
+  MALLOC_CHECK(state);
+  null_state(state);
+  state->channels_count = channels_count;
+
+  for (unsigned int i = 0; i < channels_count; ++i) {
+    Channel *channel = &state->channels[i];
+    *channel = channels[i];
+    channel->rms_bounds.rms_max_bound -= channel->rms_bounds.rms_min_bound; // Precalculate
+    init_curve(channel);
+  }
+
+  state->tones_per_port = tones_per_port;
+
+  if (tones_per_port > 1) {
+    for (unsigned int i = 0; i < channels_count; i += tones_per_port) {
+      ToneGroup *group = &state->tone_groups[state->tone_groups_count++];
+      group->first_channel = i;
+      group->tones_count = MIN(tones_per_port, channels_count - i);
+    }
+  }
+
+  return state;
+}
+
+// Frees a state that has no JACK client or sockets (offline processing
+// and benchmarks).
+void free_state(State *state)
+{
+  for (unsigned int i = 0; i < state->channels_count; ++i)
+    free_channel(&state->channels[i]);
+
+  for (unsigned int i = 0; i < state->tone_groups_count; ++i)
+    free(state->tone_groups[i].window);
+
+  free(state->mix_buf);
+  free(state->value_changes_ring.items);
+  free(state->calibration_values_ring.items);
+  free(state);
+}
+
+void init_socket_server(State *state)
+{
+  LOG("Initializing socket server…");
+  struct sockaddr_in server_address;
+  memset(&server_address, 0, sizeof(server_address));
+
+  LOG("Opening a socket…");
+  state->server_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (state->server_socket_fd < 0) PERR("Failed to open a socket");
+
+  {
+    LOG("Setting socket server address option as reusable…");
+    int enable = 1;
+    if (setsockopt(
+      state->server_socket_fd,
+      SOL_SOCKET,
+      SO_REUSEADDR,
+      &enable,
+      sizeof(enable)
+    ) < 0)
+      PERR("Failed to set socket server address option as reusable");
+  }
+
+  server_address.sin_family = AF_INET;
+  server_address.sin_addr.s_addr = INADDR_ANY;
+  server_address.sin_port = htons(socket_port);
+
+  LOG("Binding socket on %d port…", socket_port);
+  if (bind(
+    state->server_socket_fd,
+    (struct sockaddr *)&server_address,
+    sizeof(server_address)
+  ) < 0)
+    PERR("Failed to bind socket to %d port", socket_port);
+
+  LOG("Starting to listen for the socket…");
+  if (listen(state->server_socket_fd, 5) < 0)
+    PERR("Failed to start listening to a socket on %d port", socket_port);
+
+  // New connections are accepted by the event loop, it must never block.
+  set_non_blocking(state->server_socket_fd);
+
+  LOG("Allocating pool of %u socket connections…", state->max_clients);
+  state->connection_pool = malloc(sizeof(Connection) * state->max_clients);
+  MALLOC_CHECK(state->connection_pool);
+  state->free_connections = NULL;
+
+  // A queue slot per connection, allocated here as well, so accepting
+  // a client or changing its delivery policy allocates nothing (only “full”
+  // delivery policy grows its queue beyond the slot).
+  state->queue_slot_capacity =
+    state->delivery_policy.mode == DELIVERY_BOUNDED
+      ? MAX(state->delivery_policy.bound, FULL_DELIVERY_QUEUE_CAPACITY)
+      : FULL_DELIVERY_QUEUE_CAPACITY;
+
+  LOG(
+    "Allocating %u value updates queues of %zu values…",
+    state->max_clients,
+    state->queue_slot_capacity
+  );
+
+  state->queue_pool = malloc(
+    sizeof(ValueUpdate) * state->max_clients * state->queue_slot_capacity
+  );
+  MALLOC_CHECK(state->queue_pool);
+
+  for (unsigned int i = state->max_clients; i > 0; --i) {
+    Connection *connection = &state->connection_pool[i - 1];
+    connection->queue = NULL;
+    connection->slot = NULL;
+    connection->prev = NULL;
+    connection->next = state->free_connections;
+    state->free_connections = connection;
+  }
+
+  LOG("Creating epoll instance…");
+  state->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (state->epoll_fd < 0) PERR("Failed to create epoll instance");
+
+  LOG(
+    "Socket server is initialized (server socket FD: %d).",
+    state->server_socket_fd
+  );
+}
+
+// Parses “ADDRESS[:PORT]” (IPv4, the port is “socket_port” by default).
+// Returns “false” if the string is not a valid address.
+bool parse_udp_address(const char *str, struct sockaddr_in *address)
+{
+  char host[INET_ADDRSTRLEN];
+  const char *port = strchr(str, ':');
+  size_t host_length = port == NULL ? strlen(str) : (size_t)(port - str);
+  if (host_length >= sizeof(host)) return false;
+  memcpy(host, str, host_length);
+  host[host_length] = '\0';
+
+  memset(address, 0, sizeof(struct sockaddr_in));
+  address->sin_family = AF_INET;
+  address->sin_port = htons(socket_port);
+  if (inet_aton(host, &address->sin_addr) == 0) return false;
+
+  if (port != NULL) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long x = strtoul(++port, &end, 10);
+
+    if (
+      *port < '0' || *port > '9' || *end != '\0' || errno != 0
+      || x < 1 || x > UINT16_MAX
+    )
+      return false;
+
+    address->sin_port = htons(x);
+  }
+
+  return true;
+}
+
+void init_udp_sender(State *state, const struct sockaddr_in *address)
+{
+  LOG("Initializing UDP sender…");
+  state->udp_address = *address;
+
+  state->udp_socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (state->udp_socket_fd < 0) PERR("Failed to open a UDP socket");
+
+  // A full send buffer means the datagram is lost (it would be stale anyway
+  // when it finally goes out), the sender never waits.
+  set_non_blocking(state->udp_socket_fd);
+
+  if (IN_MULTICAST(ntohl(address->sin_addr.s_addr))) {
+    LOG("Setting multicast options of the UDP socket…");
+    unsigned char ttl = 1; // local network only
+    unsigned char loop = 1; // receivers on this machine get datagrams too
+
+    if (
+      setsockopt(
+        state->udp_socket_fd,
+        IPPROTO_IP,
+        IP_MULTICAST_TTL,
+        &ttl,
+        sizeof(ttl)
+      ) < 0
+      || setsockopt(
+        state->udp_socket_fd,
+        IPPROTO_IP,
+        IP_MULTICAST_LOOP,
+        &loop,
+        sizeof(loop)
+      ) < 0
+    )
+      PERR("Failed to set multicast options of the UDP socket");
+  }
+
+  LOG(
+    "UDP sender is initialized (socket FD: %d, destination: %s:%d).",
+    state->udp_socket_fd,
+    inet_ntoa(address->sin_addr),
+    ntohs(address->sin_port)
+  );
+}
+
+// Loads the recorded response curves of the channels (see “record_curve()”).
+// Lines are “CHANNEL POSITION DB”, “#” starts a comment.
+bool load_curve
+( const char     *path
+, Channel        *channels
+, unsigned int   channels_count
+)
+{
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL) {
+    fprintf(stderr, "Failed to open “%s”: %s!\n", path, strerror(errno));
+    return false;
+  }
+
+  for (unsigned int i = 0; i < channels_count; ++i)
+    channels[i].curve_points.count = 0;
+
+  char line[256];
+  unsigned int line_n = 0;
+  bool ok = true;
+
+  while (ok && fgets(line, sizeof(line), file) != NULL) {
+    ++line_n;
+    char *start = line + strspn(line, " \t");
+    if (*start == '#' || *start == '\n' || *start == '\0') continue;
+
+    unsigned int channel_n;
+    float position, rms_db;
+    char rest;
+
+    if (
+      sscanf(start, "%u %f %f %c", &channel_n, &position, &rms_db, &rest) != 3
+      || channel_n < 1 || channel_n > channels_count
+      || ! (position >= 0.0f && position <= 1.0f)
+      || ! isfinite(rms_db)
+    ) {
+      fprintf(stderr, "Incorrect line %u of response curve “%s”!\n", line_n, path);
+      ok = false;
+      break;
+    }
+
+    CurvePoints *points = &channels[channel_n - 1].curve_points;
+
+    if (points->count >= CURVE_MAX_POINTS) {
+      fprintf(
+        stderr,
+        "More than %d points of channel #%d in response curve “%s”!\n",
+        CURVE_MAX_POINTS,
+        channel_n,
+        path
+      );
+      ok = false;
+      break;
+    }
+
+    // Sorted by position
+    unsigned int j = points->count++;
+
+    for (; j > 0 && points->position[j - 1] > position; --j) {
+      points->position[j] = points->position[j - 1];
+      points->rms_db[j] = points->rms_db[j - 1];
+    }
+
+    points->position[j] = position;
+    points->rms_db[j] = rms_db;
+  }
+
+  if (ferror(file)) {
+    fprintf(stderr, "Failed to read “%s”: %s!\n", path, strerror(errno));
+    ok = false;
+  }
+
+  fclose(file);
+
+  for (unsigned int i = 0; ok && i < channels_count; ++i) {
+    CurvePoints *points = &channels[i].curve_points;
+    bool is_growing = points->count >= 2
+      && points->rms_db[0] < points->rms_db[points->count - 1];
+
+    for (unsigned int j = 1; is_growing && j < points->count; ++j)
+      is_growing = points->rms_db[j] >= points->rms_db[j - 1];
+
+    if ( ! is_growing) {
+      fprintf(
+        stderr,
+        "Response curve “%s” must have at least 2 points of channel #%d "
+        "and the level must grow with the position!\n",
+        path,
+        i + 1
+      );
+      ok = false;
+    }
+
+    channels[i].curve = CURVE_POINTS;
+  }
+
+  return ok;
+}
+
+// Amount of pedal positions recorded by “record_curve()” (0%, 25%, …, 100%).
+#define CURVE_RECORD_STEPS 5
+
+// Records response curves in calibration mode (see --record-curve).
+// Asks to set the pedals to a few positions, takes the last detected level
+// of every channel on Enter, writes the points to “path” for --curve and
+// suggests the bounds.
+void record_curve(State *state, const char *path)
+{
+  CurvePoints points[MAX_CHANNELS];
+  char line[64];
+
+  for (unsigned int step = 0; step < CURVE_RECORD_STEPS; ++step) {
+    sample_t position = (sample_t)step / (CURVE_RECORD_STEPS - 1);
+
+    for (;;) {
+      fprintf(
+        stderr,
+        "Set the pedal%s to %.0f%% and press Enter…\n",
+        state->channels_count > 1 ? "s" : "",
+        position * 100
+      );
+
+      if (wait_for_shutdown(STDIN_FILENO, -1)) {
+        fprintf(stderr, "Recording of response curve is interrupted!\n");
+        return;
+      }
+
+      if (fgets(line, sizeof(line), stdin) == NULL)
+        ERR("Recording of response curve is interrupted (end of stdin)!");
+
+      bool is_complete = true;
+
+      for (unsigned int i = 0; i < state->channels_count; ++i) {
+        sample_t rms_db = atomic_load_explicit(
+          &state->calibration_levels[i],
+          memory_order_relaxed
+        );
+
+        is_complete = is_complete && ! isnan(rms_db);
+        points[i].position[step] = position;
+        points[i].rms_db[step] = rms_db;
+      }
+
+      if (is_complete) break;
+      fprintf(stderr, "No level is detected yet, try again.\n");
+    }
+  }
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) PERR("Failed to open “%s”", path);
+  fprintf(file, "# Response curve recorded by expression-pedal (see --curve)\n");
+  fprintf(file, "# CHANNEL POSITION DB\n");
+
+  for (unsigned int i = 0; i < state->channels_count; ++i)
+    for (unsigned int step = 0; step < CURVE_RECORD_STEPS; ++step)
+      fprintf(
+        file,
+        "%d %.3f %f\n",
+        state->channels[i].number,
+        points[i].position[step],
+        points[i].rms_db[step]
+      );
+
+  if (fclose(file) != 0) PERR("Failed to write “%s”", path);
+
+  fprintf(stderr, "Response curve is written to “%s”, use it with:\n  -l ", path);
+
+  for (unsigned int i = 0; i < state->channels_count; ++i)
+    fprintf(stderr, "%s%f", i > 0 ? "," : "", points[i].rms_db[0]);
+
+  fprintf(stderr, " -u ");
+
+  for (unsigned int i = 0; i < state->channels_count; ++i)
+    fprintf(
+      stderr,
+      "%s%f",
+      i > 0 ? "," : "",
+      points[i].rms_db[CURVE_RECORD_STEPS - 1]
+    );
+
+  fprintf(stderr, " --curve %s\n", path);
+
+  for (unsigned int i = 0; i < state->channels_count; ++i) {
+    for (unsigned int step = 1; step < CURVE_RECORD_STEPS; ++step) {
+      if (points[i].rms_db[step] >= points[i].rms_db[step - 1]) continue;
+
+      fprintf(
+        stderr,
+        "WARNING: The level of channel #%d does not grow with the position, "
+        "record it again!\n",
+        state->channels[i].number
+      );
+
+      break;
+    }
+  }
+}
+
+// Automatic calibration session (see --auto-calibrate).
+//
+// The pedals are asked to be held at the heel and then at the toe. A position
+// is settled when the mean levels of the last “CALIBRATION_SETTLE_POLLS”
+// blocks (see “CalibrationStats”) are within “CALIBRATION_SETTLE_DB” and
+// the noise (standard deviation of the levels in the blocks) is below it
+// as well. The toe must also be “CALIBRATION_MIN_RANGE_DB” away
+// from the heel, so the heel is not taken twice. The bounds are moved inside
+// by “CALIBRATION_NOISE_MARGIN” noise deviations, so both ends of the range
+// are reached despite the noise.
+
+#define CALIBRATION_POLL_MS       CALIBRATION_BLOCK_MS
+#define CALIBRATION_SETTLE_POLLS  10 // 1 second
+#define CALIBRATION_SETTLE_DB     0.5f
+#define CALIBRATION_MIN_RANGE_DB  6.0f
+#define CALIBRATION_NOISE_MARGIN  3.0f
+#define CALIBRATION_TIMEOUT_S     60
+
+// Waits until the levels of all of the channels are settled
+// (at least “CALIBRATION_MIN_RANGE_DB” away from “away_from” if it is
+// not “NULL”), fills in the levels and the noise of the channels.
+// Returns “false” if the shutdown is requested before that.
+bool wait_for_settled_levels
+( State          *state
+, const sample_t *away_from
+, sample_t       *levels
+, sample_t       *noise
+)
+{
+  sample_t means[MAX_CHANNELS][CALIBRATION_SETTLE_POLLS];
+  sample_t variances[MAX_CHANNELS][CALIBRATION_SETTLE_POLLS];
+  unsigned int polls = 0;
+  unsigned int max_polls = CALIBRATION_TIMEOUT_S * 1000 / CALIBRATION_POLL_MS;
+
+  for (;; ++polls) {
+    if (polls >= max_polls)
+      ERR(
+        "The pedal%s did not settle in %d seconds!",
+        state->channels_count > 1 ? "s" : "",
+        CALIBRATION_TIMEOUT_S
+      );
+
+    if (wait_for_shutdown(-1, CALIBRATION_POLL_MS)) return false;
+
+    bool is_settled = polls + 1 >= CALIBRATION_SETTLE_POLLS;
+
+    for (unsigned int i = 0; i < state->channels_count; ++i) {
+      CalibrationStats *stats = &state->calibration_stats[i];
+      unsigned int k = polls % CALIBRATION_SETTLE_POLLS;
+      means[i][k] =
+        atomic_load_explicit(&stats->block_mean, memory_order_relaxed);
+      variances[i][k] =
+        atomic_load_explicit(&stats->block_variance, memory_order_relaxed);
+
+      sample_t lowest = means[i][0], highest = means[i][0];
+      sample_t mean = 0.0f, variance = 0.0f;
+
+      for (unsigned int j = 0; j < CALIBRATION_SETTLE_POLLS; ++j) {
+        if (means[i][j] < lowest) lowest = means[i][j];
+        if (means[i][j] > highest) highest = means[i][j];
+        mean += means[i][j] / CALIBRATION_SETTLE_POLLS;
+        variance += variances[i][j] / CALIBRATION_SETTLE_POLLS;
+      }
+
+      sample_t deviation = sqrtf(variance);
+
+      is_settled = is_settled
+        && ! isnan(mean)
+        && highest - lowest <= CALIBRATION_SETTLE_DB
+        && deviation <= CALIBRATION_SETTLE_DB
+        && (
+          away_from == NULL
+          || fabsf(mean - away_from[i]) >= CALIBRATION_MIN_RANGE_DB
+        );
+
+      levels[i] = mean;
+      noise[i] = deviation;
+    }
+
+    if (is_settled) return true;
+  }
+}
+
+// Runs the session and writes the profile for --profile to “path”.
+// Lines are “CHANNEL LOWER UPPER NOISE”, “#” starts a comment.
+void auto_calibrate(State *state, const char *path)
+{
+  sample_t heel[MAX_CHANNELS], heel_noise[MAX_CHANNELS];
+  sample_t toe[MAX_CHANNELS], toe_noise[MAX_CHANNELS];
+  bool plural = state->channels_count > 1;
+
+  fprintf(
+    stderr,
+    "Move the pedal%s all the way to the heel and hold %s there…\n",
+    plural ? "s" : "",
+    plural ? "them" : "it"
+  );
+
+  if ( ! wait_for_settled_levels(state, NULL, heel, heel_noise)) {
+    fprintf(stderr, "Automatic calibration is interrupted!\n");
+    return;
+  }
+
+  fprintf(stderr, "Heel position is settled.\n");
+
+  fprintf(
+    stderr,
+    "Now move the pedal%s all the way to the toe and hold %s there…\n",
+    plural ? "s" : "",
+    plural ? "them" : "it"
+  );
+
+  if ( ! wait_for_settled_levels(state, heel, toe, toe_noise)) {
+    fprintf(stderr, "Automatic calibration is interrupted!\n");
+    return;
+  }
+
+  fprintf(stderr, "Toe position is settled.\n");
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) PERR("Failed to open “%s”", path);
+  fprintf(file, "# Calibration profile recorded by expression-pedal (see --profile)\n");
+  fprintf(file, "# CHANNEL LOWER UPPER NOISE\n");
+
+  for (unsigned int i = 0; i < state->channels_count; ++i) {
+    CalibrationStats *stats = &state->calibration_stats[i];
+    // Reversed pedals work too, the lower level is the lower bound
+    bool is_reversed = toe[i] < heel[i];
+    sample_t low = is_reversed ? toe[i] : heel[i];
+    sample_t high = is_reversed ? heel[i] : toe[i];
+    sample_t low_noise = is_reversed ? toe_noise[i] : heel_noise[i];
+    sample_t high_noise = is_reversed ? heel_noise[i] : toe_noise[i];
+    sample_t lower = low + CALIBRATION_NOISE_MARGIN * low_noise;
+    sample_t upper = high - CALIBRATION_NOISE_MARGIN * high_noise;
+    sample_t noise = MAX(low_noise, high_noise);
+
+    if (upper <= lower)
+      ERR(
+        "The range of channel #%d is too noisy (%f to %f dB, noise %f dB)!",
+        state->channels[i].number,
+        low,
+        high,
+        noise
+      );
+
+    fprintf(
+      stderr,
+      "Channel #%d: heel %f dB, toe %f dB, noise %f dB "
+      "(seen from %f to %f dB), bounds: %f to %f dB.\n",
+      state->channels[i].number,
+      heel[i],
+      toe[i],
+      noise,
+      atomic_load_explicit(&stats->min, memory_order_relaxed),
+      atomic_load_explicit(&stats->max, memory_order_relaxed),
+      lower,
+      upper
+    );
+
+    fprintf(file, "%d %f %f %f\n", state->channels[i].number, lower, upper, noise);
+  }
+
+  if (fclose(file) != 0) PERR("Failed to write “%s”", path);
+  fprintf(stderr, "Profile is written to “%s”, use it with --profile.\n", path);
+}
+
+// Loads the bounds of the channels from a profile written by
+// “auto_calibrate()”, “count” is set to the amount of channels.
+bool load_profile
+( const char     *path
+, sample_t       *rms_min_bounds
+, sample_t       *rms_max_bounds
+, int            *count
+)
+{
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL) {
+    fprintf(stderr, "Failed to open “%s”: %s!\n", path, strerror(errno));
+    return false;
+  }
+
+  char line[256];
+  unsigned int line_n = 0;
+  bool ok = true;
+  *count = 0;
+
+  while (ok && fgets(line, sizeof(line), file) != NULL) {
+    ++line_n;
+    char *start = line + strspn(line, " \t");
+    if (*start == '#' || *start == '\n' || *start == '\0') continue;
+
+    unsigned int channel_n;
+    float lower, upper, noise;
+    char rest;
+
+    if (
+      sscanf(start, "%u %f %f %f %c", &channel_n, &lower, &upper, &noise, &rest) != 4
+      || channel_n != (unsigned int)*count + 1 || channel_n > MAX_CHANNELS
+      || ! isfinite(lower) || ! isfinite(upper) || upper <= lower
+    ) {
+      fprintf(stderr, "Incorrect line %u of profile “%s”!\n", line_n, path);
+      ok = false;
+      break;
+    }
+
+    LOG(
+      "Channel #%d bounds from the profile: %f to %f dB (noise %f dB)",
+      channel_n,
+      lower,
+      upper,
+      noise
+    );
+
+    rms_min_bounds[*count] = lower;
+    rms_max_bounds[*count] = upper;
+    ++*count;
+  }
+
+  if (ferror(file)) {
+    fprintf(stderr, "Failed to read “%s”: %s!\n", path, strerror(errno));
+    ok = false;
+  }
+
+  fclose(file);
+
+  if (ok && *count == 0) {
+    fprintf(stderr, "There are no channels in profile “%s”!\n", path);
+    ok = false;
+  }
+
+  return ok;
+}
+
+// Formats a CPU set as “0,2-3”.
+void format_cpus(const cpu_set_t *cpus, char *buf, size_t size)
+{
+  size_t length = 0;
+  buf[0] = '\0';
+
+  for (int i = 0; i < CPU_SETSIZE && length < size; ++i) {
+    if ( ! CPU_ISSET(i, cpus)) continue;
+    int last = i;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus)) ++last;
+
+    length += snprintf(
+      buf + length,
+      size - length,
+      last == i ? "%s%d" : "%s%d-%d",
+      length == 0 ? "" : ",",
+      i,
+      last
+    );
+
+    i = last;
+  }
+}
+
+// Parses a CPU list like “0,2-3”.
+// Returns “false” if the string is not a valid list of existing CPUs.
+bool parse_cpus(const char *str, cpu_set_t *cpus)
+{
+  long cpus_count = sysconf(_SC_NPROCESSORS_CONF);
+  CPU_ZERO(cpus);
+
+  for (;;) {
+    char *end = NULL;
+    long first = strtol(str, &end, 10), last = first;
+    if (end == str || first < 0) return false;
+
+    if (*end == '-') {
+      str = end + 1;
+      last = strtol(str, &end, 10);
+      if (end == str || last < first) return false;
+    }
+
+    if (last >= cpus_count || last >= CPU_SETSIZE) return false;
+    for (long i = first; i <= last; ++i) CPU_SET(i, cpus);
+
+    if (*end == '\0') return true;
+    if (*end != ',') return false;
+    str = end + 1;
+  }
+}
+
+// Prefaults and locks the memory of the process (see --lock-memory).
+// All the current and future mappings (including the stacks of the threads
+// created later) are locked and faulted in right away, and malloc keeps
+// the heap it has instead of giving it back (and faulting it in again).
+// Failures are reported, the app goes on without the locking.
+void lock_memory()
+{
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    fprintf(
+      stderr,
+      "WARNING: Failed to lock memory: %s "
+      "(see “ulimit -l” or “memlock” in “/etc/security/limits.conf”)!\n",
+      strerror(errno)
+    );
+
+    return;
+  }
+
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+
+  char *heap = malloc(PREFAULT_HEAP_SIZE);
+  MALLOC_CHECK(heap);
+  memset(heap, 0, PREFAULT_HEAP_SIZE);
+  free(heap);
+
+  fprintf(
+    stderr,
+    "Realtime setup: memory is locked, %d KiB of heap is prefaulted.\n",
+    PREFAULT_HEAP_SIZE / 1024
+  );
+}
+
+// Applies the realtime setup to a thread created by the app: pins it to
+// the CPUs and makes a consumer thread “SCHED_FIFO” below the JACK thread.
+// Failures are reported, the thread keeps running as it is.
+void setup_thread(State *state, pthread_t tid, const char *name, bool consumer)
+{
+  RealtimeSetup *setup = &state->realtime;
+
+  if (setup->pin) {
+    char cpus[256];
+    format_cpus(&setup->cpus, cpus, sizeof(cpus));
+    int err = pthread_setaffinity_np(tid, sizeof(cpu_set_t), &setup->cpus);
+
+    if (err != 0)
+      fprintf(
+        stderr,
+        "WARNING: Failed to pin %s thread to CPUs %s: %s!\n",
+        name,
+        cpus,
+        strerror(err)
+      );
+    else
+      fprintf(stderr, "Realtime setup: %s thread is pinned to CPUs %s.\n", name, cpus);
+  }
+
+  if (consumer && setup->consumer_priority > 0) {
+    int priority = setup->consumer_priority;
+
+    if (state->jack_priority > 0 && priority >= state->jack_priority) {
+      priority = MAX(state->jack_priority - 1, 1);
+
+      fprintf(
+        stderr,
+        "WARNING: Priority %d of %s thread is lowered to %d, "
+        "below JACK thread priority %d!\n",
+        setup->consumer_priority,
+        name,
+        priority,
+        state->jack_priority
+      );
+    }
+
+    struct sched_param param = { .sched_priority = priority };
+    int err = pthread_setschedparam(tid, SCHED_FIFO, &param);
+
+    if (err != 0)
+      fprintf(
+        stderr,
+        "WARNING: Failed to set SCHED_FIFO priority %d of %s thread: %s "
+        "(see “rtprio” in “/etc/security/limits.conf”)!\n",
+        priority,
+        name,
+        strerror(err)
+      );
+    else
+      fprintf(
+        stderr,
+        "Realtime setup: %s thread is SCHED_FIFO with priority %d.\n",
+        name,
+        priority
+      );
+  }
+}
+
+// Reports how the JACK thread runs, it must not share the CPUs of
+// the pinned threads.
+void report_jack_thread(State *state)
+{
+  pthread_t tid = jack_client_thread_id(state->jack_client);
+  cpu_set_t cpus;
+  int policy;
+  struct sched_param param;
+
+  if (
+    tid == 0
+    || pthread_getaffinity_np(tid, sizeof(cpu_set_t), &cpus) != 0
+    || pthread_getschedparam(tid, &policy, &param) != 0
+  ) return;
+
+  char cpus_str[256];
+  format_cpus(&cpus, cpus_str, sizeof(cpus_str));
+
+  if (policy == SCHED_FIFO || policy == SCHED_RR)
+    fprintf(
+      stderr,
+      "Realtime setup: JACK thread is %s with priority %d on CPUs %s.\n",
+      policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR",
+      param.sched_priority,
+      cpus_str
+    );
+  else
+    fprintf(stderr, "Realtime setup: JACK thread is not realtime, on CPUs %s.\n", cpus_str);
+
+  if (state->realtime.pin) {
+    CPU_AND(&cpus, &cpus, &state->realtime.cpus);
+
+    if (CPU_COUNT(&cpus) > 0) {
+      format_cpus(&cpus, cpus_str, sizeof(cpus_str));
+
+      fprintf(
+        stderr,
+        "WARNING: JACK thread may run on CPUs %s "
+        "the other threads are pinned to!\n",
+        cpus_str
+      );
+    }
+  }
+}
+
+// Runtime reconfiguration (see --control).
+//
+// A Unix socket takes command lines, one client at a time:
+//   “bounds CHANNEL LOWER UPPER” (see --lower and --upper);
+//   “frequency CHANNEL HZ” (see --frequency);
+//   “window CHANNEL SAMPLES” (see --window, 0 for the default one);
+//   “show” prints “CHANNEL LOWER UPPER FREQUENCY WINDOW” lines.
+// Every command is answered with “ok” or “error: MESSAGE” line.
+//
+// The JACK client keeps running, so the connections in the graph stay.
+
+// How long a prepared configuration waits for the realtime thread.
+#define CONTROL_ADOPT_TIMEOUT_MS 1000
+#define CONTROL_POLL_MS          1
+
+// Prepares the tables for the new configuration of the channel, hands it to
+// the realtime thread and frees the replaced one once it is handed back.
+// “config” is a configuration without tables (see “Control”).
+bool reload_channel
+( State          *state
+, unsigned int   i
+, const Channel  *config
+, char           *error
+, size_t         error_size
+)
+{
+  Channel *current = &state->control->channels[i];
+  ChannelReload *reload = malloc(sizeof(ChannelReload));
+  MALLOC_CHECK(reload);
+  reload->channel = *config;
+
+  reload->keep_signal =
+    config->sine_wave_freq == current->sine_wave_freq
+    && config->use_default_rms_window_size
+      == current->use_default_rms_window_size
+    && config->rms_window_size == current->rms_window_size;
+
+  Channel *next = &reload->channel;
+  init_channel(next, state->sample_rate);
+  init_curve(next);
+  init_channel_value_thresholds(state, next);
+
+  atomic_store_explicit(&state->pending_reloads[i], reload, memory_order_release);
+  ChannelReload *retired = NULL;
+  unsigned int waited_ms = 0;
+
+  while (retired == NULL) {
+    struct timespec delay = { 0, CONTROL_POLL_MS * 1000000 };
+    nanosleep(&delay, NULL);
+    waited_ms += CONTROL_POLL_MS;
+
+    retired = atomic_exchange_explicit(
+      &state->retired_reloads[i],
+      NULL,
+      memory_order_acquire
+    );
+
+    if (retired != NULL || waited_ms < CONTROL_ADOPT_TIMEOUT_MS) continue;
+
+    // Unless it is being adopted right now (then it comes back shortly)
+    ChannelReload *taken = atomic_exchange_explicit(
+      &state->pending_reloads[i],
+      NULL,
+      memory_order_acquire
+    );
+
+    if (taken != NULL) {
+      free_channel(&taken->channel);
+      free(taken);
+      snprintf(error, error_size, "JACK is not processing, nothing is changed");
+      return false;
+    }
+  }
+
+  free_channel(&retired->channel);
+  free(retired);
+  *current = *config;
+  return true;
+}
+
+// Handles a command line, the reply goes to “fd”.
+void handle_control_command(State *state, int fd, char *line)
+{
+  Control *control = state->control;
+  char error[256] = "";
+  unsigned int channel_n;
+  double x, y;
+  char rest;
+
+  LOG("Received a control command “%s”.", line);
+
+  if (EQ(line, "show")) {
+    for (unsigned int i = 0; i < state->channels_count; ++i) {
+      Channel *channel = &control->channels[i];
+
+      dprintf(
+        fd,
+        "%d %f %f %f %d\n",
+        channel->number,
+        channel->rms_bounds.rms_min_bound,
+        channel->rms_bounds.rms_min_bound + channel->rms_bounds.rms_max_bound,
+        channel->sine_wave_freq,
+        channel->use_default_rms_window_size ? 0 : channel->rms_window_size
+      );
+    }
+
+    dprintf(fd, "ok\n");
+    return;
+  }
+
+  char command[16];
+  int count = sscanf(line, "%15s %u %lf %lf %c", command, &channel_n, &x, &y, &rest);
+  bool is_bounds = EQ(command, "bounds");
+
+  if (
+    count < 1
+    || ! (is_bounds || EQ(command, "frequency") || EQ(command, "window"))
+  ) {
+    dprintf(fd, "error: unknown command\n");
+    return;
+  }
+
+  if (count != (is_bounds ? 4 : 3)) {
+    dprintf(fd, "error: wrong arguments\n");
+    return;
+  }
+
+  if (channel_n < 1 || channel_n > state->channels_count) {
+    dprintf(fd, "error: no channel #%u\n", channel_n);
+    return;
+  }
+
+  Channel config = control->channels[channel_n - 1];
+
+  if (is_bounds) {
+    if ( ! (isfinite(x) && isfinite(y) && y > x)) {
+      dprintf(fd, "error: upper bound must be higher than lower bound\n");
+      return;
+    }
+
+    config.rms_bounds.rms_min_bound = x;
+    config.rms_bounds.rms_max_bound = y - x; // Precalculate
+  } else if (state->tones_per_port > 1) {
+    dprintf(fd, "error: only bounds can be changed with --tones-per-port\n");
+    return;
+  } else if (EQ(command, "frequency")) {
+    if ( ! (x >= 1 && x < state->sample_rate / 2)) {
+      dprintf(fd, "error: frequency must be from 1 Hz to half of sample rate\n");
+      return;
+    }
+
+    config.sine_wave_freq = x;
+  } else {
+    if ( ! (x >= 0 && x <= state->sample_rate && x == floor(x))) {
+      dprintf(fd, "error: window must be from 0 to %d samples\n", state->sample_rate);
+      return;
+    }
+
+    config.use_default_rms_window_size = x == 0;
+    config.rms_window_size = x;
+  }
+
+  if (reload_channel(state, channel_n - 1, &config, error, sizeof(error))) {
+    fprintf(stderr, "Control command “%s” is applied.\n", line);
+    dprintf(fd, "ok\n");
+  } else {
+    dprintf(fd, "error: %s\n", error);
+  }
+}
+
+// Reads the command lines of the client until it disconnects or
+// the shutdown is requested. Too long lines are dropped.
+void serve_control_client(State *state, int fd)
+{
+  char line[256];
+  size_t size = 0;
+
+  while ( ! wait_for_shutdown(fd, -1)) {
+    ssize_t count = read(fd, line + size, sizeof(line) - 1 - size);
+
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) return;
+    size += count;
+    line[size] = '\0';
+
+    char *start = line, *end;
+
+    while ((end = strchr(start, '\n')) != NULL) {
+      *end = '\0';
+      start[strcspn(start, "\r")] = '\0';
+      if (start[0] != '\0') handle_control_command(state, fd, start);
+      start = end + 1;
+    }
+
+    size -= start - line;
+    memmove(line, start, size);
+    if (size == sizeof(line) - 1) size = 0;
+  }
+}
+
+void* control_loop(void *arg)
+{
+  State *state = (State *)arg;
+
+  while ( ! wait_for_shutdown(state->control->socket_fd, -1)) {
+    int fd = accept(state->control->socket_fd, NULL, NULL);
+
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      PERR("Failed to accept a control socket connection");
+    }
+
+    LOG("Control socket connection is accepted (FD: %d).", fd);
+    serve_control_client(state, fd);
+    close(fd);
+    LOG("Control socket connection is closed.");
+  }
+
+  LOG("Control thread is stopped.");
+  return NULL;
+}
+
+// Opens the control socket, must be called before the JACK client is
+// activated (the configuration of the channels is copied from the state).
+void init_control(State *state, char *path)
+{
+  LOG("Initializing control socket “%s”…", path);
+  Control *control = malloc(sizeof(Control));
+  MALLOC_CHECK(control);
+  control->path = path;
+
+  for (unsigned int i = 0; i < state->channels_count; ++i) {
+    Channel *channel = &control->channels[i];
+    *channel = state->channels[i];
+    channel->oscillator.wavetable = NULL;
+    channel->rms_history          = NULL;
+    channel->lockin_sin           = NULL;
+    channel->lockin_cos           = NULL;
+    channel->value_thresholds     = NULL;
+    channel->value16_thresholds   = NULL;
+    channel->curve_table          = NULL;
+  }
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(address.sun_path))
+    ERR("Control socket path “%s” is too long!", path);
+
+  strcpy(address.sun_path, path);
+  control->socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (control->socket_fd < 0) PERR("Failed to open control socket");
+  unlink(path); // left by a previous run
+
+  if (
+    bind(control->socket_fd, (struct sockaddr *)&address, sizeof(address)) != 0
+    || listen(control->socket_fd, 1) != 0
+  ) PERR("Failed to listen on control socket “%s”", path);
+
+  state->control = control;
+
+  int err = pthread_create(&control->tid, NULL, &control_loop, state);
+  if (err != 0) ERR("Failed to create a thread: [%s]", strerror(err));
+  setup_thread(state, control->tid, "control", false);
+
+  fprintf(stderr, "Accepting control commands on “%s” Unix socket…\n", path);
+}
+
+// Creates the shared memory segment for the latest values (see --shm).
+// Must be called when the sample rate is known, before the JACK client is
+// activated.
+void init_shm(State *state, char *name)
+{
+  LOG("Initializing shared memory segment “%s”…", name);
+  int fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+  if (fd < 0) PERR("Failed to open shared memory segment “%s”", name);
+
+  // Truncating to zero first clears what a previous run left there
+  if (ftruncate(fd, 0) != 0 || ftruncate(fd, sizeof(EpShm)) != 0)
+    PERR("Failed to resize shared memory segment “%s”", name);
+
+  EpShm *shm =
+    mmap(NULL, sizeof(EpShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (shm == MAP_FAILED) PERR("Failed to map shared memory segment “%s”", name);
+  close(fd);
+
+  shm->version        = EP_SHM_VERSION;
+  shm->channels_count = state->channels_count;
+  shm->sample_rate    = state->sample_rate;
+  shm->pid            = getpid();
+  atomic_store_explicit(&shm->magic, EP_SHM_MAGIC, memory_order_release);
+
+  state->shm = shm;
+  state->shm_name = name;
+  fprintf(stderr, "Publishing values to “%s” shared memory segment…\n", name);
+}
+
+// Interactive calibration session (see --record-curve and --auto-calibrate),
+// it runs on its own thread so the main thread can handle the shutdown.
+typedef struct {
+  State               *state;
+  const char          *curve_record_path;   // or “NULL”
+  const char          *profile_record_path; // or “NULL”
+} CalibrationSession;
+
+void* run_calibration_session(void *arg)
+{
+  CalibrationSession *session = (CalibrationSession *)arg;
+
+  if (session->curve_record_path != NULL)
+    record_curve(session->state, session->curve_record_path);
+  else
+    auto_calibrate(session->state, session->profile_record_path);
+
+  request_shutdown(false);
+  return NULL;
+}
+
+void run
+( Channel        *channels // configured channels (see “null_channel()”)
+, unsigned int   channels_count
+, unsigned int   tones_per_port
+, OutputFormat   output_format
+, bool           socket_server
+, DeliveryPolicy delivery_policy // for socket server only
+, unsigned int   max_clients // for socket server only
+, const struct sockaddr_in *udp_address // UDP destination or “NULL”
+, MidiOutput     midi
+, sample_t       cv_smoothing // in seconds, negative to turn CV output off
+, unsigned int   stats_interval // in seconds, 0 to turn stats off
+, bool           calibrate
+, const char     *curve_record_path // calibration mode only, or “NULL”
+, const char     *profile_record_path // calibration mode only, or “NULL”
+, char           *control_path // Unix socket for --control or “NULL”
+, char           *shm_name // shared memory segment for --shm or “NULL”
+, RealtimeSetup  realtime
+)
+{
+  // Before anything else is allocated (the later allocations are locked too)
+  if (realtime.lock_memory) lock_memory();
+  init_shutdown_request();
+
+  LOG("Initialization of state…");
+  State *state = new_state(channels, channels_count, tones_per_port);
+  state->realtime = realtime;
+  state->output_format = output_format;
+  // Socket clients can switch to any format, UDP datagrams are 8-bit only,
+  // the shared memory has every format.
+  state->high_resolution =
+    socket_server
+    || (shm_name != NULL && ! calibrate)
+    || (udp_address == NULL
+        && (output_format == OUTPUT_FORMAT_FRAMED_U16
+            || output_format == OUTPUT_FORMAT_FRAMED_F32));
+  state->delivery_policy = delivery_policy;
+  state->max_clients = max_clients;
+  state->midi = midi;
+  state->midi.enabled = midi.enabled && ! calibrate;
+  state->cv_output = cv_smoothing >= 0.0f && ! calibrate;
+  state->cv_smoothing = MAX(cv_smoothing, 0.0f);
+  state->stats_interval = stats_interval;
+  state->auto_calibration = profile_record_path != NULL;
+  state->values_event_fd = eventfd(0, EFD_CLOEXEC);
+  if (state->values_event_fd < 0) PERR("Failed to create an eventfd");
+  if (calibrate)
+    RING_INIT(state->calibration_values_ring, VALUE_RING_SIZE)
+  else {
+    RING_INIT(state->value_changes_ring, VALUE_RING_SIZE)
+    init_value_thresholds(state);
+  }
+
+  LOG("State is initialized…");
+
+  LOG("Opening JACK client…");
+  jack_status_t status;
+
+  state->jack_client = jack_client_open(
+    jack_client_name,
+    JackNullOption,
+    &status,
+    NULL
+  );
+
+  if (state->jack_client == NULL) ERRJACK("Opening client failed!");
+
+  if (status & JackNameNotUnique)
+    ERRJACK("Client name “%s” is already taken!", jack_client_name);
+
+  LOG("JACK client is opened.");
+  state->jack_priority = jack_client_real_time_priority(state->jack_client);
+  register_ports(state);
+  bind_callbacks(state, calibrate);
+
+  // In case JACK did not call it on binding
+  if (tones_per_port > 1 && state->mix_buf == NULL)
+    set_buffer_size(jack_get_buffer_size(state->jack_client), state);
+
+  if (socket_server) init_socket_server(state);
+  if (udp_address != NULL) init_udp_sender(state, udp_address);
+  if (control_path != NULL && ! calibrate) init_control(state, control_path);
+  if (shm_name != NULL && ! calibrate) init_shm(state, shm_name);
+
+  LOG("Running a thread for handing value updates queue…");
+
+  {
+    int err = pthread_create(
+      &state->consumer_tid,
+      NULL,
+      calibrate
+        ? &handle_calibrate_value_updates
+        : socket_server
+          ? &socket_server_loop
+          : &handle_value_updates,
+      (void *)state
+    );
+
+    if (err != 0) ERR("Failed to create a thread: [%s]", strerror(err));
+
+    LOG(
+      "Value updates handling thread is spawned (thread id: %ld).",
+      state->consumer_tid
+    );
+
+    setup_thread(state, state->consumer_tid, "value updates", true);
+  }
+
+  if (stats_interval != 0) {
+    LOG("Running a thread for reporting realtime stats…");
+    int err = pthread_create(&state->stats_tid, NULL, &report_stats_loop, state);
+    if (err != 0) ERR("Failed to create a thread: [%s]", strerror(err));
+    LOG("Realtime stats reporting thread is spawned.");
+    setup_thread(state, state->stats_tid, "stats", false);
+  }
+
+  LOG("Setting shutdown callbacks…");
+  jack_on_shutdown(state->jack_client, jack_shutdown_callback, NULL);
+  signal(SIGABRT, sig_handler);
+  signal(SIGHUP,  sig_handler);
+  signal(SIGINT,  sig_handler);
+  signal(SIGQUIT, sig_handler);
+  signal(SIGTERM, sig_handler);
+
+  if (udp_address != NULL && ! calibrate)
+    fprintf(
+      stderr,
+      "Playing sine wave, analyzing returned signal and sending detected "
+      "values to %s:%d as UDP datagrams (in range from 0 to %d)…\n",
+      inet_ntoa(udp_address->sin_addr),
+      ntohs(udp_address->sin_port),
+      UINT8_MAX
+    );
+  else if (output_format == OUTPUT_FORMAT_BINARY)
+    fprintf(
+      stderr,
+      "Playing sine wave, analyzing returned signal and %s "
+      "as 8-bit binary unsigned integers (in range from 0 to %d)…\n",
+      socket_server
+        ? "sending detected values to socket server clients"
+        : "printing detected values to stdout",
+      UINT8_MAX
+    );
+  else if (output_format != OUTPUT_FORMAT_TEXT)
+    fprintf(
+      stderr,
+      "Playing sine wave, analyzing returned signal and %s "
+      "as frames of binary protocol version %d with %s…\n",
+      socket_server
+        ? "sending detected values to socket server clients"
+        : "printing detected values to stdout",
+      FRAME_VERSION,
+      output_format == OUTPUT_FORMAT_FRAMED_U16
+        ? "16-bit unsigned integers (in range from 0 to 65535)"
+        : "float32 numbers (in range from 0.0 to 1.0)"
+    );
+  else
+    fprintf(
+      stderr,
+      "Playing sine wave, analyzing returned signal and %s "
+      "as lines with human-readable text with numbers "
+      "(in range from 0 to %d)…\n",
+      socket_server
+        ? "sending detected values to socket server clients"
+        : "printing detected values to stdout",
+      UINT8_MAX
+    );
+
+  if (
+    channels_count > 1 && udp_address == NULL
+    && (output_format == OUTPUT_FORMAT_TEXT
+        || output_format == OUTPUT_FORMAT_BINARY)
+  )
+    fprintf(
+      stderr,
+      "Handling %d pedals, every value is prefixed with the channel number "
+      "(%s)…\n",
+      channels_count,
+      output_format == OUTPUT_FORMAT_BINARY
+        ? "a byte before the value"
+        : "“CHANNEL VALUE” lines"
+    );
+
+  if (state->midi.enabled)
+    fprintf(
+      stderr,
+      "Sending detected values as %s MIDI Control Change messages "
+      "on MIDI channel %d to JACK “midi_out” port…\n",
+      state->midi.fine ? "14-bit" : "7-bit",
+      state->midi.channel + 1
+    );
+
+  if (state->cv_output)
+    fprintf(
+      stderr,
+      "Writing detected positions as a control signal (from 0.0 to 1.0) "
+      "to JACK “%s” port(s)…\n",
+      channels_count > 1 ? "cv_N" : "cv"
+    );
+
+  if (jack_activate(state->jack_client) != 0)
+    ERRJACK("Client activation failed!");
+
+  // The JACK thread is created by the activation, it would inherit
+  // the affinity of this thread if it was pinned before.
+  if (realtime.pin) setup_thread(state, pthread_self(), "main", false);
+
+  if (
+    realtime.lock_memory
+    || realtime.consumer_priority > 0
+    || realtime.pin
+  ) report_jack_thread(state);
+
+  CalibrationSession session = { state, curve_record_path, profile_record_path };
+
+  if (curve_record_path != NULL || profile_record_path != NULL) {
+    int err = pthread_create(
+      &state->session_tid,
+      NULL,
+      &run_calibration_session,
+      &session
+    );
+
+    if (err != 0) ERR("Failed to create a thread: [%s]", strerror(err));
+    state->has_session = true;
+  }
+
+  wait_for_shutdown(-1, -1);
+  terminate_app(state);
+}
+
+// End-to-end latency test (see --latency-test).
+//
+// Runs without JACK: a driver thread stands in for the JACK process callback.
+// It wakes up every period like JACK would (samples of a period are processed
+// when the next period starts, once they are all captured), renders the sine
+// wave and feeds it back delayed by a period and attenuated by a synthetic
+// pedal that steps between two positions. The usual value consumer of every
+// output path runs on its own thread and the test reads the values back like
+// a client would. The latency is from the step to the moment the first value
+// past the middle of the range is received, so it includes the detection
+// window, the period, the queue and the transport.
+
+#define LATENCY_TEST_SAMPLE_RATE 48000
+#define LATENCY_TEST_BUFFER_SIZE 256
+#define LATENCY_TEST_STEP_MS     100
+#define LATENCY_TEST_STEPS       50
+#define LATENCY_TEST_LOW_GAIN    0.05f
+#define LATENCY_TEST_HIGH_GAIN   0.5f
+#define LATENCY_TEST_IDLE_MS     500 // wait for late values after the last step
+
+typedef enum {
+  LATENCY_PATH_STDOUT, // text lines through a pipe
+  LATENCY_PATH_TCP,    // text lines through the socket server
+  LATENCY_PATH_UDP,    // datagrams over loopback
+} LatencyPath;
+
+typedef struct {
+  State               *state;
+  jack_nframes_t      step_size; // in frames
+  atomic_bool         done;
+} LatencyDriver;
+
+void* drive_latency_test(void *arg)
+{
+  LatencyDriver *driver = (LatencyDriver *)arg;
+  State *state = driver->state;
+  jack_nframes_t n = state->buffer_size;
+  jack_nframes_t total = driver->step_size * (LATENCY_TEST_STEPS + 1);
+
+  sample_t *send_buf = calloc(n, sizeof(sample_t));
+  MALLOC_CHECK(send_buf);
+  sample_t *sent_buf = calloc(n, sizeof(sample_t)); // of the previous period
+  MALLOC_CHECK(sent_buf);
+  sample_t *return_buf = malloc(sizeof(sample_t) * n);
+  MALLOC_CHECK(return_buf);
+
+  for (jack_nframes_t frame = 0; frame < total; frame += n) {
+    long long wake_us = frame_time_us(state, frame + n);
+    struct timespec wake = { wake_us / 1000000, wake_us % 1000000 * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+
+    for (jack_nframes_t i = 0; i < n; ++i) {
+      bool high = (frame + i) / driver->step_size % 2 == 1;
+      return_buf[i] =
+        sent_buf[i] * (high ? LATENCY_TEST_HIGH_GAIN : LATENCY_TEST_LOW_GAIN);
+    }
+
+    process_period(state, frame, &send_buf, &return_buf, n, handle_mean_square);
+
+    sample_t *tmp = sent_buf;
+    sent_buf = send_buf;
+    send_buf = tmp;
+  }
+
+  free(send_buf);
+  free(sent_buf);
+  free(return_buf);
+  atomic_store(&driver->done, true);
+  return NULL;
+}
+
+int compare_latencies(const void *a, const void *b)
+{
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+// Reads the values of the output path back and matches them with the steps
+// (odd steps go up, even ones go down). Returns the amount of latencies
+// (in µs) stored to “latencies” (“LATENCY_TEST_STEPS” long).
+unsigned int receive_latency_values
+( LatencyDriver  *driver
+, LatencyPath    path
+, int            fd
+, long long      *latencies
+)
+{
+  State *state = driver->state;
+  unsigned int count = 0, step = 1;
+  unsigned int value = 0;
+  bool has_digits = false;
+  char buf[512];
+
+  for (;;) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, LATENCY_TEST_IDLE_MS);
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready < 0) PERR("Failed to poll for latency test values");
+    if (ready == 0 && atomic_load(&driver->done)) break;
+    if (ready == 0) continue;
+
+    // A datagram at a time for UDP
+    ssize_t size = read(fd, buf, sizeof(buf));
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) PERR("Failed to read latency test values");
+    long long received_us = now_us(state);
+
+    for (ssize_t i = 0; i < size; ++i) {
+      if (path == LATENCY_PATH_UDP) {
+        if (size != UDP_DATAGRAM_SIZE) break;
+        value = (uint8_t)buf[2];
+        i = size;
+      } else if (buf[i] >= '0' && buf[i] <= '9') {
+        value = value * 10 + (buf[i] - '0');
+        has_digits = true;
+        continue;
+      } else if (buf[i] != '\n' || ! has_digits) {
+        continue;
+      }
+
+      // A step without a value past the middle is missed
+      while (
+        step < LATENCY_TEST_STEPS
+        && received_us >= frame_time_us(state, (step + 1) * driver->step_size)
+      ) ++step;
+
+      bool up = step % 2 == 1;
+      long long step_us = frame_time_us(state, step * driver->step_size);
+
+      if (
+        step <= LATENCY_TEST_STEPS && received_us >= step_us
+        && (up ? value > UINT8_MAX / 2 : value <= UINT8_MAX / 2)
+      ) {
+        latencies[count++] = received_us - step_us;
+        ++step;
+      }
+
+      value = 0;
+      has_digits = false;
+    }
+  }
+
+  return count;
+}
+
+void run_latency_test_path(Channel *channel, LatencyPath path)
+{
+  char *names[] = { "stdout", "tcp", "udp" };
+  State *state = new_state(channel, 1, 1);
+  state->output_format = OUTPUT_FORMAT_TEXT;
+  state->stats_interval = 1; // delivery latency is recorded, nothing is printed
+  state->values_event_fd = eventfd(0, EFD_CLOEXEC);
+  if (state->values_event_fd < 0) PERR("Failed to create an eventfd");
+  RING_INIT(state->value_changes_ring, VALUE_RING_SIZE)
+  set_sample_rate(LATENCY_TEST_SAMPLE_RATE, state);
+  set_buffer_size(LATENCY_TEST_BUFFER_SIZE, state);
+  init_value_thresholds(state);
+
+  void* (*consumer)(void *) = &handle_value_updates;
+  int fd = -1, saved_stdout = -1;
+  struct sockaddr_in address;
+  socklen_t address_size = sizeof(address);
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (path == LATENCY_PATH_STDOUT) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) PERR("Failed to create a pipe");
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    if (dup2(pipe_fds[1], STDOUT_FILENO) < 0) PERR("Failed to redirect stdout");
+    close(pipe_fds[1]);
+    fd = pipe_fds[0];
+  } else if (path == LATENCY_PATH_TCP) {
+    init_socket_server(state);
+    consumer = &socket_server_loop;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    address.sin_port = htons(socket_port);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+      PERR("Failed to connect to the socket server");
+  } else {
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (
+      fd < 0
+      || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0
+      || getsockname(fd, (struct sockaddr *)&address, &address_size) != 0
+    ) PERR("Failed to open a UDP socket for the latency test");
+    init_udp_sender(state, &address);
+  }
+
+  pthread_t consumer_tid, driver_tid;
+  int err = pthread_create(&consumer_tid, NULL, consumer, state);
+  if (err != 0) ERR("Failed to create a thread: [%s]", strerror(err));
+
+  LatencyDriver driver;
+  driver.state = state;
+  driver.step_size = LATENCY_TEST_SAMPLE_RATE * LATENCY_TEST_STEP_MS / 1000;
+  atomic_init(&driver.done, false);
+  state->frames_epoch_us = now_us(state);
+  err = pthread_create(&driver_tid, NULL, &drive_latency_test, &driver);
+  if (err != 0) ERR("Failed to create a thread: [%s]", strerror(err));
+
+  long long latencies[LATENCY_TEST_STEPS];
+  unsigned int count = receive_latency_values(&driver, path, fd, latencies);
+
+  pthread_join(driver_tid, NULL);
+
+  // The consumer finishes what it is writing and stops on its own
+  atomic_store(&state->is_stopping, true);
+  if (eventfd_write(state->values_event_fd, 1) != 0)
+    PERR("Failed to write to the eventfd");
+  pthread_join(consumer_tid, NULL);
+
+  if (path == LATENCY_PATH_STDOUT) {
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+  } else if (path == LATENCY_PATH_TCP) {
+    while (state->socket_connections != NULL)
+      close_connection(state, state->socket_connections);
+    close(state->server_socket_fd);
+    close(state->epoll_fd);
+    free(state->connection_pool);
+    free(state->queue_pool);
+  } else {
+    close(state->udp_socket_fd);
+  }
+
+  close(fd);
+  close(state->values_event_fd);
+  qsort(latencies, count, sizeof(long long), compare_latencies);
+  char steps[32];
+  sprintf(steps, "%u/%d", count, LATENCY_TEST_STEPS);
+
+  if (count == 0) {
+    printf("%-8s %8s %8s %8s %8s %8s %14s\n",
+      names[path], steps, "-", "-", "-", "-", "-");
+  } else {
+    printf(
+      "%-8s %8s %8.2f %8.2f %8.2f %8.2f %14llu\n",
+      names[path],
+      steps,
+      latencies[count / 2] / 1000.0,
+      latencies[count * 90 / 100] / 1000.0,
+      latencies[count * 99 / 100] / 1000.0,
+      latencies[count - 1] / 1000.0,
+      delivery_latency_percentile(&state->stats, 50)
+    );
+  }
+
+  fflush(stdout);
+  free_state(state);
+}
+
+void latency_test(Channel *channel)
+{
+  // The synthetic pedal steps between the bounds
+  channel->rms_bounds.rms_min_bound =
+    finalize_rms_db(1, powf(LATENCY_TEST_LOW_GAIN, 2) / 2);
+  channel->rms_bounds.rms_max_bound =
+    finalize_rms_db(1, powf(LATENCY_TEST_HIGH_GAIN, 2) / 2);
+
+  printf(
+    "Sample rate: %d, buffer size: %d, %d steps every %d ms, "
+    "sine wave: %.0f Hz\n",
+    LATENCY_TEST_SAMPLE_RATE,
+    LATENCY_TEST_BUFFER_SIZE,
+    LATENCY_TEST_STEPS,
+    LATENCY_TEST_STEP_MS,
+    channel->sine_wave_freq
+  );
+
+  printf(
+    "Latency from a step of the pedal to receiving a value past the middle "
+    "(ms),\nthe last column is the time from the detected frame to writing "
+    "the value out\n\n"
+  );
+
+  printf(
+    "%-8s %8s %8s %8s %8s %8s %14s\n",
+    "path", "steps", "p50", "p90", "p99", "max", "send p50 < µs"
+  );
+
+  run_latency_test_path(channel, LATENCY_PATH_STDOUT);
+  run_latency_test_path(channel, LATENCY_PATH_TCP);
+  run_latency_test_path(channel, LATENCY_PATH_UDP);
+}
+
+// Detectors benchmark (see --benchmark-detectors).
+//
+// Synthetic returned signal is the sent sine wave delayed by a few samples
+// (round trip through the audio interface) and attenuated by the “pedal”,
+// plus mains hum and white noise. For every detector configuration it reports:
+//   * bias and jitter (standard deviation) of the detected level at a constant
+//     low attenuation — the noise floor;
+//   * latency — time from a step of the attenuation to the moment
+//     the detected level settles within ±1 dB around the new level.
+// Levels are in the same dB units as --lower and --upper.
+
+#define BENCHMARK_SAMPLE_RATE 48000
+#define BENCHMARK_DELAY       37     // samples
+#define BENCHMARK_LOW_GAIN    0.05f
+#define BENCHMARK_HIGH_GAIN   0.5f
+#define BENCHMARK_HUM_FREQ    50.0f  // Hz
+#define BENCHMARK_HUM_AMP     0.02f
+#define BENCHMARK_NOISE_AMP   0.005f
+#define BENCHMARK_TOLERANCE   1.0f   // dB
+
+typedef struct {
+  jack_nframes_t      position; // current sample
+  size_t              count;
+  jack_nframes_t      *positions;
+  sample_t            *levels;
+} BenchmarkRecording;
+
+BenchmarkRecording benchmark_recording = { 0, 0, NULL, NULL };
+
+void record_benchmark_level
+( State          *state
+, Channel        *channel
+, jack_nframes_t offset
+, sample_t       mean_square
+)
+{
+  benchmark_recording.positions[benchmark_recording.count] =
+    benchmark_recording.position;
+  benchmark_recording.levels[benchmark_recording.count] = AMP_TO_DB(mean_square);
+  ++benchmark_recording.count;
+}
+
+void benchmark_detector
+( char           *title
+, sample_t       sine_wave_freq
+, DetectorType   detector
+, RmsMode        rms_mode
+, jack_nframes_t rms_window_size
+, jack_nframes_t rms_hop_size // 0 for default value
+)
+{
+  Channel *channel = (Channel *)malloc(sizeof(Channel));
+  MALLOC_CHECK(channel);
+  null_channel(channel);
+  channel->number = 1;
+  channel->sine_wave_freq = sine_wave_freq;
+  channel->detector = detector;
+  channel->rms_mode = rms_mode;
+  channel->rms_window_size = rms_window_size;
+  channel->use_default_rms_hop_size = rms_hop_size == 0;
+  channel->rms_hop_size = rms_hop_size;
+  init_channel(channel, BENCHMARK_SAMPLE_RATE);
+
+  jack_nframes_t total   = BENCHMARK_SAMPLE_RATE * 2;
+  jack_nframes_t step_at = BENCHMARK_SAMPLE_RATE;
+  sample_t *send_buf   = malloc(sizeof(sample_t) * total);
+  MALLOC_CHECK(send_buf);
+  sample_t *return_buf = malloc(sizeof(sample_t) * total);
+  MALLOC_CHECK(return_buf);
+  benchmark_recording.position  = 0;
+  benchmark_recording.count     = 0;
+  benchmark_recording.positions = malloc(sizeof(jack_nframes_t) * total);
+  MALLOC_CHECK(benchmark_recording.positions);
+  benchmark_recording.levels    = malloc(sizeof(sample_t) * total);
+  MALLOC_CHECK(benchmark_recording.levels);
+
+  render_sine_wave(channel, send_buf, total);
+  uint32_t noise_seed = 2463534242; // xorshift32
+
+  for (jack_nframes_t i = 0; i < total; ++i) {
+    noise_seed ^= noise_seed << 13;
+    noise_seed ^= noise_seed >> 17;
+    noise_seed ^= noise_seed << 5;
+    sample_t noise = (sample_t)noise_seed / UINT32_MAX * 2 - 1;
+
+    return_buf[i]
+      = (i < BENCHMARK_DELAY ? 0.0f : send_buf[i - BENCHMARK_DELAY])
+        * (i < step_at ? BENCHMARK_LOW_GAIN : BENCHMARK_HIGH_GAIN)
+      + BENCHMARK_HUM_AMP
+        * sin(sample_radians(BENCHMARK_HUM_FREQ, i, BENCHMARK_SAMPLE_RATE))
+      + BENCHMARK_NOISE_AMP * noise;
+  }
+
+  // One sample at a time, so the position of every detected level is exact.
+  for (jack_nframes_t i = 0; i < total; ++i) {
+    benchmark_recording.position = i;
+
+    process_detector(
+      NULL,
+      channel,
+      return_buf + i,
+      1,
+      i % channel->sine_wave_one_rotation_samples,
+      record_benchmark_level
+    );
+  }
+
+  sample_t low_level  = finalize_rms_db(1, powf(BENCHMARK_LOW_GAIN,  2) / 2);
+  sample_t high_level = finalize_rms_db(1, powf(BENCHMARK_HIGH_GAIN, 2) / 2);
+  double sum = 0.0, sum_of_sq = 0.0;
+  size_t n = 0;
+  jack_nframes_t settled_at = total;
+
+  for (size_t i = 0; i < benchmark_recording.count; ++i) {
+    jack_nframes_t position = benchmark_recording.positions[i];
+    sample_t level = benchmark_recording.levels[i];
+
+    if (position >= step_at / 2 && position < step_at) {
+      sum += level;
+      sum_of_sq += level * level;
+      ++n;
+    } else if (position >= step_at) {
+      if (fabsf(level - high_level) > BENCHMARK_TOLERANCE)
+        settled_at = total;
+      else if (settled_at == total)
+        settled_at = position + 1;
+    }
+  }
+
+  double mean = n == 0 ? NAN : sum / n;
+  double jitter = n == 0 ? NAN : sqrt(MAX(sum_of_sq / n - mean * mean, 0.0));
+
+  printf(
+    "%-24s %8d %6d %10.3f %10.4f %11.2f\n",
+    title,
+    channel->rms_window_size,
+    channel->rms_mode == RMS_MODE_SLIDING ? channel->rms_hop_size : 0,
+    mean - low_level,
+    jitter,
+    settled_at == total
+      ? NAN
+      : (settled_at - step_at) * 1000.0 / BENCHMARK_SAMPLE_RATE
+  );
+
+  free(benchmark_recording.positions);
+  free(benchmark_recording.levels);
+  benchmark_recording.positions = NULL;
+  benchmark_recording.levels = NULL;
+  free(send_buf);
+  free(return_buf);
+  free_channel(channel);
+  free(channel);
+}
+
+void benchmark_detectors(sample_t sine_wave_freq)
+{
+  jack_nframes_t rotation = round(BENCHMARK_SAMPLE_RATE / sine_wave_freq);
+
+  printf(
+    "Sine wave: %.0f Hz, sample rate: %d, "
+    "mains hum: %.0f Hz at %.3f, white noise at %.3f\n",
+    sine_wave_freq,
+    BENCHMARK_SAMPLE_RATE,
+    BENCHMARK_HUM_FREQ,
+    BENCHMARK_HUM_AMP,
+    BENCHMARK_NOISE_AMP
+  );
+
+  printf(
+    "Gain %.2f (%.2f dB), then %.2f (%.2f dB), "
+    "latency is until settled within ±%.1f dB\n\n",
+    BENCHMARK_LOW_GAIN,
+    finalize_rms_db(1, powf(BENCHMARK_LOW_GAIN, 2) / 2),
+    BENCHMARK_HIGH_GAIN,
+    finalize_rms_db(1, powf(BENCHMARK_HIGH_GAIN, 2) / 2),
+    BENCHMARK_TOLERANCE
+  );
+
+  printf(
+    "%-24s %8s %6s %10s %10s %11s\n",
+    "detector", "window", "hop", "bias dB", "jitter dB", "latency ms"
+  );
+
+  benchmark_detector(
+    "rms tumbling", sine_wave_freq,
+    DETECTOR_RMS, RMS_MODE_TUMBLING, rotation, 0
+  );
+  benchmark_detector(
+    "rms tumbling", sine_wave_freq,
+    DETECTOR_RMS, RMS_MODE_TUMBLING, rotation * 10, 0
+  );
+  benchmark_detector(
+    "rms sliding", sine_wave_freq,
+    DETECTOR_RMS, RMS_MODE_SLIDING, rotation * 10, rotation
+  );
+  benchmark_detector(
+    "lockin", sine_wave_freq,
+    DETECTOR_LOCKIN, RMS_MODE_TUMBLING, rotation, 0
+  );
+  benchmark_detector(
+    "lockin", sine_wave_freq,
+    DETECTOR_LOCKIN, RMS_MODE_TUMBLING, rotation * 10, 0
+  );
+}
+
+// Throughput benchmark (see --benchmark-throughput and “make benchmark”).
+// Runs “process_period()” over a synthetic returned signal for every
+// detector, oscillator and buffer size and reports the time it takes
+// per sample (a single channel, so it is per channel per sample).
+
+#define THROUGHPUT_BENCHMARK_SECONDS 10
+
+unsigned long long throughput_benchmark_values = 0;
+
+void count_benchmark_value
+( State          *state
+, Channel        *channel
+, jack_nframes_t offset
+, sample_t       mean_square
+)
+{
+  ++throughput_benchmark_values;
+}
+
+void benchmark_throughput_case
+( char           *title
+, DetectorType   detector
+, RmsMode        rms_mode
+, OscillatorType oscillator_type
+, jack_nframes_t buffer_size
+, const sample_t *signal // “BENCHMARK_SAMPLE_RATE” long
+)
+{
+  Channel channel;
+  null_channel(&channel);
+  channel.number = 1;
+  channel.sine_wave_freq = 440.0f;
+  channel.detector = detector;
+  channel.rms_mode = rms_mode;
+  channel.oscillator.type = oscillator_type;
+  channel.use_default_rms_window_size = true;
+  channel.use_default_rms_hop_size = true;
+
+  State *state = new_state(&channel, 1, 1);
+  set_sample_rate(BENCHMARK_SAMPLE_RATE, state);
+  set_buffer_size(buffer_size, state);
+
+  sample_t *send_buf = malloc(sizeof(sample_t) * buffer_size);
+  MALLOC_CHECK(send_buf);
+  sample_t *return_buf = malloc(sizeof(sample_t) * buffer_size);
+  MALLOC_CHECK(return_buf);
+
+  jack_nframes_t total = BENCHMARK_SAMPLE_RATE * THROUGHPUT_BENCHMARK_SECONDS;
+  jack_nframes_t frames = 0;
+  double ns = 0.0;
+
+  while (frames < total) {
+    // Copying the input is not measured, JACK provides the buffers too
+    for (jack_nframes_t i = 0; i < buffer_size; ++i)
+      return_buf[i] = signal[(frames + i) % BENCHMARK_SAMPLE_RATE];
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    process_period(
+      state,
+      frames,
+      &send_buf,
+      &return_buf,
+      buffer_size,
+      count_benchmark_value
+    );
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns += elapsed_ns(&start, &end);
+    frames += buffer_size;
+  }
+
+  printf(
+    "%-16s %-10s %8d %10.2f\n",
+    title,
+    oscillator_type == OSCILLATOR_SIN
+      ? "sin"
+      : oscillator_type == OSCILLATOR_WAVETABLE ? "wavetable" : "recursive",
+    buffer_size,
+    ns / frames
+  );
+
+  free(send_buf);
+  free(return_buf);
+  free_state(state);
+}
+
+void benchmark_throughput()
+{
+  jack_nframes_t buffer_sizes[] = { 64, 256, 1024 };
+  OscillatorType oscillators[] = {
+    OSCILLATOR_SIN,
+    OSCILLATOR_WAVETABLE,
+    OSCILLATOR_RECURSIVE,
+  };
+
+  // Same kind of signal as the detectors benchmark uses, just not delayed
+  sample_t *signal = malloc(sizeof(sample_t) * BENCHMARK_SAMPLE_RATE);
+  MALLOC_CHECK(signal);
+  uint32_t noise_seed = 2463534242; // xorshift32
+
+  for (jack_nframes_t i = 0; i < BENCHMARK_SAMPLE_RATE; ++i) {
+    noise_seed ^= noise_seed << 13;
+    noise_seed ^= noise_seed >> 17;
+    noise_seed ^= noise_seed << 5;
+    sample_t noise = (sample_t)noise_seed / UINT32_MAX * 2 - 1;
+
+    signal[i]
+      = BENCHMARK_HIGH_GAIN
+        * sin(sample_radians(440.0f, i, BENCHMARK_SAMPLE_RATE))
+      + BENCHMARK_NOISE_AMP * noise;
+  }
+
+  printf(
+    "Sample rate: %d, %d seconds of signal per case, "
+    "sum of squares kernel: %s\n\n",
+    BENCHMARK_SAMPLE_RATE,
+    THROUGHPUT_BENCHMARK_SECONDS,
+    SUM_OF_SQUARES_BACKEND
+  );
+
+  printf(
+    "%-16s %-10s %8s %10s\n",
+    "detector", "oscillator", "buffer", "ns/sample"
+  );
+
+  for (size_t b = 0; b < sizeof(buffer_sizes) / sizeof(*buffer_sizes); ++b) {
+    for (size_t o = 0; o < sizeof(oscillators) / sizeof(*oscillators); ++o) {
+      benchmark_throughput_case(
+        "rms tumbling", DETECTOR_RMS, RMS_MODE_TUMBLING,
+        oscillators[o], buffer_sizes[b], signal
+      );
+      benchmark_throughput_case(
+        "rms sliding", DETECTOR_RMS, RMS_MODE_SLIDING,
+        oscillators[o], buffer_sizes[b], signal
+      );
+      benchmark_throughput_case(
+        "lockin", DETECTOR_LOCKIN, RMS_MODE_TUMBLING,
+        oscillators[o], buffer_sizes[b], signal
+      );
+    }
+  }
+
+  free(signal);
+  fprintf(
+    stderr,
+    "%llu values detected in total.\n",
+    throughput_benchmark_values
+  );
+}
+
+// Self-test (see --self-test and “make test”).
+// Checks the numeric backends against their reference implementations
+// outside of the JACK callbacks, prints a PASS/FAIL line per case.
+
+bool self_test()
+{
+  jack_nframes_t sample_rates[] = { 44100, 48000, 96000 };
+  sample_t freqs[] = { 220.0f, 440.0f, 1000.0f };
+  OscillatorType oscillators[] = {
+    OSCILLATOR_SIN,
+    OSCILLATOR_WAVETABLE,
+    OSCILLATOR_RECURSIVE,
+  };
+
+  unsigned int failed = 0, total = 1;
+  if ( ! check_sum_of_squares()) ++failed;
+
+  for (size_t r = 0; r < sizeof(sample_rates) / sizeof(*sample_rates); ++r) {
+    for (size_t f = 0; f < sizeof(freqs) / sizeof(*freqs); ++f) {
+      for (size_t o = 0; o < sizeof(oscillators) / sizeof(*oscillators); ++o) {
+        Channel channel;
+        null_channel(&channel);
+        channel.number = 1;
+        channel.sine_wave_freq = freqs[f];
+        channel.oscillator.type = oscillators[o];
+        channel.use_default_rms_window_size = true;
+        channel.use_default_rms_hop_size = true;
+        init_channel(&channel, sample_rates[r]);
+
+        if ( ! check_oscillator(&channel)) ++failed;
+        ++total;
+        free_channel(&channel);
+      }
+    }
+  }
+
+  printf("\n%s: %u of %u checks failed.\n", failed ? "FAIL" : "PASS", failed, total);
+  return failed == 0;
+}
+
+// Offline processing (see --offline).
+// A capture of returned signal (a channel per send/return port pair) is read
+// from a WAV file (32-bit float or 16-bit integer PCM) or from a raw file
+// (interleaved native 32-bit floats), run through “process_period()”
+// as fast as possible and detected values are written to stdout in the same
+// output format as the live client would print them.
+
+typedef enum {
+  CAPTURE_FLOAT32,
+  CAPTURE_INT16,
+} CaptureEncoding;
+
+typedef struct {
+  FILE                *file;
+  bool                raw; // no header, samples are in native byte order
+  CaptureEncoding     encoding;
+  unsigned int        channels;
+  jack_nframes_t      sample_rate;
+} Capture;
+
+#define WAVE_FORMAT_PCM        0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+static inline uint32_t read_le(const uint8_t *buf, size_t size)
+{
+  uint32_t x = 0;
+  for (size_t i = size; i > 0; --i) x = (x << 8) | buf[i - 1];
+  return x;
+}
+
+// Opens a capture. For a raw file (no RIFF/WAVE header) “channels”
+// and “sample_rate” are taken as provided.
+// Returns “false” if the file is not supported (the reason is printed).
+bool open_capture
+( const char     *path
+, Capture        *capture
+, unsigned int   channels
+, jack_nframes_t sample_rate
+)
+{
+  capture->file = fopen(path, "rb");
+
+  if (capture->file == NULL) {
+    fprintf(stderr, "Failed to open “%s”: %s!\n", path, strerror(errno));
+    return false;
+  }
+
+  uint8_t header[12];
+
+  if (
+    fread(header, 1, sizeof(header), capture->file) != sizeof(header)
+    || memcmp(header, "RIFF", 4) != 0
+    || memcmp(header + 8, "WAVE", 4) != 0
+  ) {
+    LOG("No RIFF/WAVE header in “%s”, reading it as raw floats…", path);
+    rewind(capture->file);
+    capture->raw = true;
+    capture->encoding = CAPTURE_FLOAT32;
+    capture->channels = channels;
+    capture->sample_rate = sample_rate;
+    return true;
+  }
+
+  capture->raw = false;
+  bool has_format = false;
+  uint8_t chunk[8];
+
+  while (fread(chunk, 1, sizeof(chunk), capture->file) == sizeof(chunk)) {
+    uint32_t size = read_le(chunk + 4, 4);
+
+    if (memcmp(chunk, "data", 4) == 0) {
+      if (has_format) return true;
+      break;
+    } else if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+      uint8_t format[40] = { 0 };
+      size_t format_size = MIN(size, sizeof(format));
+      if (fread(format, 1, format_size, capture->file) != format_size) break;
+      // Chunks are word-aligned
+      fseek(capture->file, size - format_size + (size & 1), SEEK_CUR);
+
+      uint16_t tag = read_le(format, 2);
+      uint16_t bits = read_le(format + 14, 2);
+      if (tag == WAVE_FORMAT_EXTENSIBLE && size >= 26)
+        tag = read_le(format + 24, 2); // sub-format GUID starts with the tag
+
+      capture->channels = read_le(format + 2, 2);
+      capture->sample_rate = read_le(format + 4, 4);
+
+      if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32)
+        capture->encoding = CAPTURE_FLOAT32;
+      else if (tag == WAVE_FORMAT_PCM && bits == 16)
+        capture->encoding = CAPTURE_INT16;
+      else {
+        fprintf(
+          stderr,
+          "Unsupported WAV encoding in “%s” (format %d, %d bits), "
+          "only 32-bit float and 16-bit integer PCM are supported!\n",
+          path,
+          tag,
+          bits
+        );
+        fclose(capture->file);
+        return false;
+      }
+
+      has_format = true;
+    } else {
+      fseek(capture->file, size + (size & 1), SEEK_CUR);
+    }
+  }
+
+  fprintf(stderr, "Malformed WAV file “%s”!\n", path);
+  fclose(capture->file);
+  return false;
+}
+
+// Reads up to “nframes” frames and splits the channels into “bufs”.
+// “scratch” must fit “nframes” interleaved frames of 32-bit samples.
+// Returns amount of frames read (0 at the end of the file).
+jack_nframes_t read_capture
+( Capture        *capture
+, sample_t       **bufs
+, uint8_t        *scratch
+, jack_nframes_t nframes
+)
+{
+  size_t sample_size = capture->encoding == CAPTURE_INT16 ? 2 : 4;
+  size_t frame_size = sample_size * capture->channels;
+  jack_nframes_t n = fread(scratch, frame_size, nframes, capture->file);
+
+  for (jack_nframes_t i = 0; i < n; ++i) {
+    for (unsigned int k = 0; k < capture->channels; ++k) {
+      uint8_t *sample = scratch + i * frame_size + k * sample_size;
+
+      if (capture->encoding == CAPTURE_INT16) {
+        bufs[k][i] = (int16_t)read_le(sample, 2) / 32768.0f;
+      } else if (capture->raw) {
+        memcpy(&bufs[k][i], sample, sizeof(float));
+      } else {
+        uint32_t x = read_le(sample, 4);
+        memcpy(&bufs[k][i], &x, sizeof(float));
+      }
+    }
+  }
+
+  return n;
+}
+
+// Writes the values collected in the rings to stdout.
+void write_offline_values(State *state, bool calibrate)
+{
+  if (calibrate) {
+    DecibelsUpdate update;
+
+    while (RING_SHIFT(state->calibration_values_ring, &update)) {
+      atomic_store_explicit(
+        &state->calibration_levels[update.channel - 1],
+        update.rms_db,
+        memory_order_relaxed
+      );
+
+      if (state->channels_count > 1)
+        printf("%u %f\n", update.channel, update.rms_db);
+      else
+        printf("%f\n", update.rms_db);
+    }
+
+    return;
+  }
+
+  ValueUpdate update;
+  char buf[VALUE_UPDATE_MAX_SIZE];
+
+  while (RING_SHIFT(state->value_changes_ring, &update)) {
+    if ( ! is_value_update_visible(state->output_format, update)) continue;
+    size_t size = format_value_update(state, state->output_format, update, buf);
+    fwrite(buf, 1, size, stdout);
+  }
+}
+
+void run_offline
+( Channel        *channels // configured channels (see “null_channel()”)
+, unsigned int   channels_count
+, unsigned int   tones_per_port
+, OutputFormat   output_format
+, const char     *path
+, jack_nframes_t sample_rate // for raw files
+, jack_nframes_t buffer_size
+, bool           calibrate
+)
+{
+  State *state = new_state(channels, channels_count, tones_per_port);
+  state->output_format = output_format;
+  state->high_resolution =
+    output_format == OUTPUT_FORMAT_FRAMED_U16
+    || output_format == OUTPUT_FORMAT_FRAMED_F32;
+  if ( ! calibrate) init_value_thresholds(state);
+  unsigned int ports_count = port_pairs_count(state);
+
+  Capture capture;
+
+  if ( ! open_capture(path, &capture, ports_count, sample_rate))
+    exit(EXIT_FAILURE);
+
+  if (capture.channels != ports_count) {
+    fprintf(
+      stderr,
+      "Capture “%s” has %d channel(s), but there are %d return port(s)!\n",
+      path,
+      capture.channels,
+      ports_count
+    );
+    exit(EXIT_FAILURE);
+  }
+
+  set_sample_rate(capture.sample_rate, state);
+  set_buffer_size(buffer_size, state);
+
+  // Every window of every channel can end within a buffer, so the rings
+  // are big enough for the values of a whole buffer.
+  size_t ring_size = VALUE_RING_SIZE;
+  while (ring_size < (size_t)buffer_size * channels_count) ring_size *= 2;
+
+  if (calibrate)
+    RING_INIT(state->calibration_values_ring, ring_size)
+  else
+    RING_INIT(state->value_changes_ring, ring_size)
+
+  sample_t *send_bufs[MAX_CHANNELS], *return_bufs[MAX_CHANNELS];
+
+  for (unsigned int i = 0; i < ports_count; ++i) {
+    send_bufs[i] = malloc(sizeof(sample_t) * buffer_size);
+    MALLOC_CHECK(send_bufs[i]);
+    return_bufs[i] = malloc(sizeof(sample_t) * buffer_size);
+    MALLOC_CHECK(return_bufs[i]);
+  }
+
+  uint8_t *scratch = malloc(sizeof(float) * buffer_size * ports_count);
+  MALLOC_CHECK(scratch);
+
+  fprintf(
+    stderr,
+    "Processing %s “%s” (%d channel(s), %d Hz) with %d samples buffers…\n",
+    capture.raw ? "raw capture" : "WAV capture",
+    path,
+    capture.channels,
+    capture.sample_rate,
+    buffer_size
+  );
+
+  jack_nframes_t frame_time = 0, n = 0;
+  double ns = 0.0;
+
+  while ((n = read_capture(&capture, return_bufs, scratch, buffer_size)) > 0) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    process_period(
+      state,
+      frame_time,
+      send_bufs,
+      return_bufs,
+      n,
+      calibrate ? handle_calibrate_mean_square : handle_mean_square
+    );
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns += elapsed_ns(&start, &end);
+    frame_time += n;
+    write_offline_values(state, calibrate);
+  }
+
+  if (ferror(capture.file)) PERR("Failed to read “%s”", path);
+  fclose(capture.file);
+  fflush(stdout);
+
+  fprintf(
+    stderr,
+    "Processed %d frames (%.2f s) in %.3f ms, %.2f ns per frame "
+    "(%.0f× realtime).\n",
+    frame_time,
+    (double)frame_time / state->sample_rate,
+    ns / 1e6,
+    frame_time == 0 ? 0.0 : ns / frame_time,
+    ns == 0.0 ? 0.0 : frame_time * 1e9 / state->sample_rate / ns
+  );
+
+  for (unsigned int i = 0; i < ports_count; ++i) {
+    free(send_bufs[i]);
+    free(return_bufs[i]);
+  }
+
+  free(scratch);
+  free_state(state);
+}
+
+// Parses a comma-separated list of numbers (e.g. “-90,-85.5,-80”)
+// for per-channel command-line arguments.
+// Returns amount of parsed numbers or -1 if the list is malformed.
+int parse_numbers_list(char *str, double *numbers, int max)
+{
+  for (int n = 0; n < max;) {
+    char *end = NULL;
+    numbers[n++] = strtod(str, &end);
+    if (end == str) return -1;
+    if (*end == '\0') return n;
+    if (*end != ',') return -1;
+    str = end + 1;
+  }
+
+  return -1;
+}
+
+// An item of a per-channel values list, a single value is used for all
+// the channels.
+#define LIST_ITEM(list, count, i) ((count) == 1 ? (list)[0] : (list)[i])
+
+void show_usage(FILE *out, char *app)
+{
+  size_t i = 0;
+  char spaces[128];
+  for (i = 0; i < strlen(app); ++i) spaces[i] = ' ';
+  spaces[i] = '\0';
+  fprintf(out, "Usage: %s -l|--lower FLOAT\n", app);
+  fprintf(out, "       %s -u|--upper FLOAT\n", spaces);
+  fprintf(out, "       %s [-c|--calibrate [--record-curve FILE]]\n", spaces);
+  fprintf(out, "       %s [--auto-calibrate FILE]\n", spaces);
+  fprintf(out, "       %s [--profile FILE]\n", spaces);
+  fprintf(out, "       %s [-b|--binary]\n", spaces);
+  fprintf(out, "       %s [--format text|binary|u16|f32]\n", spaces);
+  fprintf(out, "       %s [-s|--socket]\n", spaces);
+  fprintf(out, "       %s [--delivery latest|bounded:N|full]\n", spaces);
+  fprintf(out, "       %s [--max-clients UINT]\n", spaces);
+  fprintf(out, "       %s [--udp ADDRESS[:PORT]]\n", spaces);
+  fprintf(out, "       %s [--midi-cc UINT [--midi-channel UINT] [--midi-14bit]]\n", spaces);
+  fprintf(out, "       %s [--cv [--cv-smoothing FLOAT]]\n", spaces);
+  fprintf(out, "       %s [--stats UINT]\n", spaces);
+  fprintf(out, "       %s [--control PATH]\n", spaces);
+  fprintf(out, "       %s [--shm NAME]\n", spaces);
+  fprintf(out, "       %s [--lock-memory]\n", spaces);
+  fprintf(out, "       %s [--consumer-priority UINT]\n", spaces);
+  fprintf(out, "       %s [--pin-cpus LIST]\n", spaces);
+  fprintf(out, "       %s [-f|--frequency UINT]\n", spaces);
+  fprintf(out, "       %s [-w|--rms-window UINT]\n", spaces);
+  fprintf(out, "       %s [-n|--channels UINT]\n", spaces);
+  fprintf(out, "       %s [-t|--tones-per-port UINT]\n", spaces);
+  fprintf(out, "       %s [--detector rms|lockin]\n", spaces);
+  fprintf(out, "       %s [--rms-mode tumbling|sliding]\n", spaces);
+  fprintf(out, "       %s [--hop UINT]\n", spaces);
+  fprintf(out, "       %s [-o|--oscillator sin|wavetable|recursive]\n", spaces);
+  fprintf(out, "       %s [--curve linear|log|exp|s-curve|FILE]\n", spaces);
+  fprintf(out, "       %s [--hysteresis FLOAT]\n", spaces);
+  fprintf(out, "       %s [--one-euro MIN_CUTOFF[,BETA]]\n", spaces);
+  fprintf(out, "       %s [--offline FILE [--sample-rate UINT] [--buffer-size UINT]]\n", spaces);
+  fprintf(out, "       %s --benchmark-detectors [-f|--frequency UINT]\n", app);
+  fprintf(out, "       %s --benchmark-throughput\n", app);
+  fprintf(out, "       %s --self-test\n", app);
+  fprintf(out, "       %s --latency-test [-f|--frequency UINT] [-w|--rms-window UINT] ...\n", app);
+  fprintf(out, "\n");
+  fprintf(out, "For me (the author of the program) the range between -90 dB and -6 dB works well:\n");
+  fprintf(out, "  %s -l -90 -u -6\n", app);
+  fprintf(out, "\n");
+  fprintf(out, "Options marked as per-channel take either a single value for all the pedals\n");
+  fprintf(out, "or a comma-separated list with a value for every pedal, for instance\n");
+  fprintf(out, "three pedals with different bounds:\n");
+  fprintf(out, "  %s -l -90,-85,-92 -u -6\n", app);
+  fprintf(out, "\n");
+  fprintf(out, "Available options:\n");
+  fprintf(out, "  -l,--lower FLOAT      Set min RMS in dB (see --calibrate, per-channel).\n");
+  fprintf(out, "  -u,--upper FLOAT      Set max RMS in dB (see --calibrate, per-channel).\n");
+  fprintf(out, "  -c,--calibrate        Calibrate min and max RMS bounds.\n");
+  fprintf(out, "                        Set your pedal to minimum position and record the value.\n");
+  fprintf(out, "                        Then do the same for maximum position.\n");
+  fprintf(out, "                        Use those values for --lower and --upper arguments.\n");
+  fprintf(out, "  --auto-calibrate FILE Calibrate the bounds automatically: hold the pedal(s)\n");
+  fprintf(out, "                        at the heel until the level settles, then at the toe.\n");
+  fprintf(out, "                        The bounds (moved inside by 3 deviations of the\n");
+  fprintf(out, "                        noise) are written to FILE for --profile.\n");
+  fprintf(out, "  --profile FILE        Load the bounds from a profile written by\n");
+  fprintf(out, "                        --auto-calibrate (instead of --lower and --upper).\n");
+  fprintf(out, "  -b,--binary           Print binary unsigned 8-bit integers sequence\n");
+  fprintf(out, "                        instead of human-readable lines\n");
+  fprintf(out, "                        (same as --format binary).\n");
+  fprintf(out, "  --format FORMAT       Output format (default value is text):\n");
+  fprintf(out, "                          text   - human-readable lines with 8-bit values;\n");
+  fprintf(out, "                          binary - raw 8-bit values;\n");
+  fprintf(out, "                          u16    - frames of versioned binary protocol\n");
+  fprintf(out, "                                   with 16-bit values (0 to 65535);\n");
+  fprintf(out, "                          f32    - same frames with float32 values\n");
+  fprintf(out, "                                   (0.0 to 1.0).\n");
+  fprintf(out, "                        A frame is a sync byte 0x%X, protocol version %d,\n", FRAME_SYNC, FRAME_VERSION);
+  fprintf(out, "                        value type (%d for u16, %d for f32), channel number,\n", FRAME_VALUE_U16, FRAME_VALUE_F32);
+  fprintf(out, "                        32-bit JACK frame time and the value (big-endian).\n");
+  fprintf(out, "                        Socket clients get this format by default and\n");
+  fprintf(out, "                        can choose their own by sending a “format FORMAT”\n");
+  fprintf(out, "                        line to the server.\n");
+  fprintf(out, "  -s,--socket           Start socket server on port %d and send\n", socket_port);
+  fprintf(out, "                        values to connected clients\n");
+  fprintf(out, "                        (see --format).\n");
+  fprintf(out, "  --delivery POLICY     How value updates are kept for a socket client\n");
+  fprintf(out, "                        that does not read them fast enough\n");
+  fprintf(out, "                        (default value is bounded:%zu):\n", DEFAULT_DELIVERY_POLICY.bound);
+  fprintf(out, "                          latest    - only the latest value of every\n");
+  fprintf(out, "                                      pedal, older ones are coalesced;\n");
+  fprintf(out, "                          bounded:N - up to N (1 to %d) values,\n", UINT16_MAX);
+  fprintf(out, "                                      the oldest ones are dropped;\n");
+  fprintf(out, "                          full      - every value, up to %d, then\n", FULL_DELIVERY_QUEUE_MAX_CAPACITY);
+  fprintf(out, "                                      the oldest ones are dropped.\n");
+  fprintf(out, "                        A client can choose its own policy by sending\n");
+  fprintf(out, "                        a “delivery POLICY” line to the server\n");
+  fprintf(out, "                        (bounded:N up to the bound of this one or %d).\n", FULL_DELIVERY_QUEUE_CAPACITY);
+  fprintf(out, "  --max-clients UINT    Max amount of socket clients connected at once\n");
+  fprintf(out, "                        (from 1 to %d, default value is %d). Others get\n", MAX_MAX_CLIENTS, DEFAULT_MAX_CLIENTS);
+  fprintf(out, "                        “error: too many clients” line (or an error frame\n");
+  fprintf(out, "                        for u16 and f32 formats) and are disconnected,\n");
+  fprintf(out, "                        accepting is paused for a while after that.\n");
+  fprintf(out, "  --udp ADDRESS[:PORT]  Send every value as a UDP datagram to IPv4 unicast\n");
+  fprintf(out, "                        or multicast ADDRESS (default PORT is %d)\n", socket_port);
+  fprintf(out, "                        instead of printing it to stdout. A datagram carries\n");
+  fprintf(out, "                        the channel number, the value, a sequence number\n");
+  fprintf(out, "                        and a JACK frame time, so receivers can drop stale\n");
+  fprintf(out, "                        datagrams and measure jitter (see “udp_receiver.py”).\n");
+  fprintf(out, "                        Multicast datagrams do not leave the local network.\n");
+  fprintf(out, "  --midi-cc UINT        Also send values as MIDI Control Change messages\n");
+  fprintf(out, "                        with this controller number (0 to 119, per-channel)\n");
+  fprintf(out, "                        to JACK “midi_out” port. Messages are placed at\n");
+  fprintf(out, "                        the exact frame where the value was detected.\n");
+  fprintf(out, "  --midi-channel UINT   MIDI channel of --midi-cc (1 to 16, default value is 1).\n");
+  fprintf(out, "  --midi-14bit          14-bit values for --midi-cc: MSB with the controller\n");
+  fprintf(out, "                        number (0 to 31) and LSB with the number + 32.\n");
+  fprintf(out, "  --cv                  Also write pedal position (0.0 to 1.0) as a control\n");
+  fprintf(out, "                        signal to JACK “cv” audio port (“cv_N” for every\n");
+  fprintf(out, "                        pedal with --channels), to use it as a modulation\n");
+  fprintf(out, "                        source in other JACK clients.\n");
+  fprintf(out, "  --cv-smoothing FLOAT  Time constant in ms of the low-pass filter smoothing\n");
+  fprintf(out, "                        the steps of --cv signal between detected values\n");
+  fprintf(out, "                        (0 for steps, default value is %g).\n", CV_DEFAULT_SMOOTHING_MS);
+  fprintf(out, "  -f,--frequency UINT   Frequency in Hz of a sine wave to send\n");
+  fprintf(out, "                        (default value is 440, per-channel).\n");
+  fprintf(out, "  -w,--rms-window UINT  RMS window size in amount of samples\n");
+  fprintf(out, "                        (default value is one rotation of the sine wave,\n");
+  fprintf(out, "                        so sample rate divided by --frequency,\n");
+  fprintf(out, "                        so for 48000 sample rate and 440 Hz --frequency\n");
+  fprintf(out, "                        it will be ≈109, per-channel).\n");
+  fprintf(out, "  -n,--channels UINT    Amount of pedals (up to %d, default value is\n", MAX_CHANNELS);
+  fprintf(out, "                        the length of per-channel values lists or 1).\n");
+  fprintf(out, "                        Every pedal gets its own “send_N” and “return_N”\n");
+  fprintf(out, "                        JACK ports (N starts from 1) and every value is\n");
+  fprintf(out, "                        prefixed with the channel number N\n");
+  fprintf(out, "                        (“N VALUE” lines or a byte before the value\n");
+  fprintf(out, "                        with --binary). A single pedal keeps “send” and\n");
+  fprintf(out, "                        “return” ports and values without a prefix.\n");
+  fprintf(out, "  -t,--tones-per-port UINT\n");
+  fprintf(out, "                        Frequency-division multiplexing: amount of pedals\n");
+  fprintf(out, "                        sharing a single pair of ports (default value is 1).\n");
+  fprintf(out, "                        Sine waves of consecutive pedals are mixed into\n");
+  fprintf(out, "                        one send port and separated from the return port\n");
+  fprintf(out, "                        by Goertzel filters, so the pedals must have\n");
+  fprintf(out, "                        different --frequency values (better not harmonics\n");
+  fprintf(out, "                        of each other). --rms-window is the integration\n");
+  fprintf(out, "                        length shared by the group (default value is %d\n", TONE_GROUP_DEFAULT_WINDOW_ROTATIONS);
+  fprintf(out, "                        rotations of the lowest frequency), --detector\n");
+  fprintf(out, "                        and --rms-mode do not apply. Calibrate every pedal\n");
+  fprintf(out, "                        with the same --tones-per-port and --frequency.\n");
+  fprintf(out, "  --detector TYPE       How pedal position is detected from returned signal\n");
+  fprintf(out, "                        (default value is rms):\n");
+  fprintf(out, "                          rms    - broadband RMS;\n");
+  fprintf(out, "                          lockin - synchronous I/Q demodulation\n");
+  fprintf(out, "                                   against the sent sine wave,\n");
+  fprintf(out, "                                   rejects mains hum and noise.\n");
+  fprintf(out, "                                   --rms-window is the integration length\n");
+  fprintf(out, "                                   (better be a multiple of one rotation\n");
+  fprintf(out, "                                   of the sine wave).\n");
+  fprintf(out, "  --rms-mode MODE       How RMS windows follow each other\n");
+  fprintf(out, "                        (default value is tumbling):\n");
+  fprintf(out, "                          tumbling - one value per --rms-window samples;\n");
+  fprintf(out, "                          sliding  - moving window, one value per\n");
+  fprintf(out, "                                     --hop samples, so longer (smoother)\n");
+  fprintf(out, "                                     windows do not add latency.\n");
+  fprintf(out, "  --hop UINT            Hop size in amount of samples for sliding\n");
+  fprintf(out, "                        --rms-mode (1 for a value per sample,\n");
+  fprintf(out, "                        default value is a quarter of --rms-window).\n");
+  fprintf(out, "  -o,--oscillator TYPE  Sine wave generator (default value is wavetable):\n");
+  fprintf(out, "                          sin       - call “sin()” for every sample;\n");
+  fprintf(out, "                          wavetable - precomputed single rotation\n");
+  fprintf(out, "                                      (same output as “sin”);\n");
+  fprintf(out, "                          recursive - rotating phasor, no table lookups\n");
+  fprintf(out, "                                      (deviates from “sin” by ≈1e-7).\n");
+  fprintf(out, "  --curve CURVE         Response curve, how the position between the bounds\n");
+  fprintf(out, "                        is mapped to the value (default value is linear):\n");
+  fprintf(out, "                          linear  - linear in dB;\n");
+  fprintf(out, "                          log     - rises fast at the start, then slowly;\n");
+  fprintf(out, "                          exp     - rises slowly at the start, then fast;\n");
+  fprintf(out, "                          s-curve - rises slowly at both ends;\n");
+  fprintf(out, "                          FILE    - through the levels recorded by\n");
+  fprintf(out, "                                    --record-curve, the output follows\n");
+  fprintf(out, "                                    the pedal travel for any potentiometer\n");
+  fprintf(out, "                                    taper.\n");
+  fprintf(out, "  --record-curve FILE   With --calibrate asks to set the pedal(s) to a few\n");
+  fprintf(out, "                        positions (press Enter for every one), then writes\n");
+  fprintf(out, "                        the detected levels to FILE for --curve and prints\n");
+  fprintf(out, "                        the bounds to use with it.\n");
+  fprintf(out, "  --hysteresis FLOAT    Keep the value until the pedal moves further than\n");
+  fprintf(out, "                        half a step plus FLOAT steps of 8-bit value from it\n");
+  fprintf(out, "                        (default value is 0), stops a pedal at rest from\n");
+  fprintf(out, "                        flickering between adjacent values. For instance\n");
+  fprintf(out, "                        0.3. The lowest and the highest values are always\n");
+  fprintf(out, "                        reachable. Applies to 16-bit values as well.\n");
+  fprintf(out, "  --one-euro MIN_CUTOFF[,BETA]\n");
+  fprintf(out, "                        Smooth detected levels with One-Euro filter, the\n");
+  fprintf(out, "                        cutoff frequency (Hz) starts from MIN_CUTOFF when\n");
+  fprintf(out, "                        the pedal is at rest and grows by BETA Hz per dB/s\n");
+  fprintf(out, "                        of movement (default value is 0, constant cutoff).\n");
+  fprintf(out, "                        For instance 1,0.05.\n");
+  fprintf(out, "  --lock-memory         Prefault and lock all the memory of the process,\n");
+  fprintf(out, "                        so the threads never wait for page faults\n");
+  fprintf(out, "                        (needs “memlock” limit, see “ulimit -l”).\n");
+  fprintf(out, "  --consumer-priority UINT\n");
+  fprintf(out, "                        Run the thread that delivers the values\n");
+  fprintf(out, "                        (stdout, socket, UDP) with SCHED_FIFO priority\n");
+  fprintf(out, "                        UINT, always lower than the JACK thread priority\n");
+  fprintf(out, "                        (needs “rtprio” limit, see “ulimit -r”).\n");
+  fprintf(out, "  --pin-cpus LIST       Pin the threads other than the JACK one to LIST\n");
+  fprintf(out, "                        of CPUs (like “2,3” or “1-3”), away from the CPU\n");
+  fprintf(out, "                        JACK runs on (see “isolcpus” or “taskset” for JACK).\n");
+  fprintf(out, "                        What is applied is reported to stderr.\n");
+  fprintf(out, "  --shm NAME            Also publish the latest value of every channel to\n");
+  fprintf(out, "                        NAME POSIX shared memory segment (like\n");
+  fprintf(out, "                        “/expression-pedal”) for readers on the same host.\n");
+  fprintf(out, "                        Readers poll it or wait for changes without any\n");
+  fprintf(out, "                        system calls on the fast path, see\n");
+  fprintf(out, "                        “src/expression_pedal_shm.h” client header.\n");
+  fprintf(out, "  --control PATH        Accept commands that change the configuration\n");
+  fprintf(out, "                        without restarting JACK client on PATH Unix socket.\n");
+  fprintf(out, "                        Commands are lines, every one is answered with “ok”\n");
+  fprintf(out, "                        or “error: MESSAGE”:\n");
+  fprintf(out, "                          bounds CHANNEL LOWER UPPER\n");
+  fprintf(out, "                          frequency CHANNEL HZ\n");
+  fprintf(out, "                          window CHANNEL SAMPLES (0 for the default one)\n");
+  fprintf(out, "                          show (“CHANNEL LOWER UPPER FREQUENCY WINDOW”)\n");
+  fprintf(out, "                        For instance:\n");
+  fprintf(out, "                          echo 'bounds 1 -40 -6' | socat - UNIX:PATH\n");
+  fprintf(out, "  --stats UINT          Print realtime stats to stderr every UINT seconds:\n");
+  fprintf(out, "                        time spent in JACK process callback (histogram\n");
+  fprintf(out, "                        of the load in percent of the period), xruns,\n");
+  fprintf(out, "                        max depth of the values ring, dropped values\n");
+  fprintf(out, "                        and delivery latency (from the frame a value was\n");
+  fprintf(out, "                        detected at to writing it out).\n");
+  fprintf(out, "  --offline FILE        Do not connect to JACK, read returned signal from\n");
+  fprintf(out, "                        a capture file instead (a channel per return port),\n");
+  fprintf(out, "                        process it as fast as possible, print the values\n");
+  fprintf(out, "                        (dB values with --calibrate) to stdout and exit.\n");
+  fprintf(out, "                        FILE is a WAV file (32-bit float or 16-bit integer)\n");
+  fprintf(out, "                        or raw interleaved 32-bit floats.\n");
+  fprintf(out, "  --sample-rate UINT    Sample rate of a raw --offline capture\n");
+  fprintf(out, "                        (default value is 48000).\n");
+  fprintf(out, "  --buffer-size UINT    Buffer size in samples for --offline processing\n");
+  fprintf(out, "                        (like JACK period, default value is 256).\n");
+  fprintf(out, "  --benchmark-detectors Compare noise floor and latency of the detectors\n");
+  fprintf(out, "                        on a synthetic signal and exit.\n");
+  fprintf(out, "  --benchmark-throughput\n");
+  fprintf(out, "                        Measure processing time per sample of every\n");
+  fprintf(out, "                        detector, oscillator and buffer size and exit\n");
+  fprintf(out, "                        (see also “make benchmark”).\n");
+  fprintf(out, "  --self-test           Check the oscillators and the sum of squares\n");
+  fprintf(out, "                        kernel against the reference implementations,\n");
+  fprintf(out, "                        report PASS/FAIL and exit\n");
+  fprintf(out, "                        (see also “make test”).\n");
+  fprintf(out, "  --latency-test        Measure latency from a step of a synthetic pedal\n");
+  fprintf(out, "                        to receiving the value through stdout (a pipe),\n");
+  fprintf(out, "                        TCP (--socket) and UDP (--udp) over loopback\n");
+  fprintf(out, "                        without JACK, report percentiles and exit.\n");
+  fprintf(out, "                        Detector options apply (the first pedal only).\n");
+  fprintf(out, "  -h,-?,--help          Show this help text.\n");
+}
+
+int main(int argc, char *argv[])
+{
+  LOG("Starting of application…");
+
+  // Per-channel values, a single value is used for all the channels
+  // (see “parse_numbers_list()”).
+  sample_t       rms_min_bounds[MAX_CHANNELS];
+  int            rms_min_bounds_count   = 0;
+  sample_t       rms_max_bounds[MAX_CHANNELS];
+  int            rms_max_bounds_count   = 0;
+  sample_t       sine_wave_freqs[MAX_CHANNELS];
+  int            sine_wave_freqs_count  = 0;
+  jack_nframes_t rms_window_sizes[MAX_CHANNELS];
+  int            rms_window_sizes_count = 0;
+  uint8_t        midi_ccs[MAX_CHANNELS];
+  int            midi_ccs_count         = 0;
+
+  unsigned int   channels_count  = 0; // 0 for derived from the lists
+  unsigned int   tones_per_port  = 1;
+  OutputFormat   output_format   = OUTPUT_FORMAT_TEXT;
+  bool           socket_server   = false;
+  DeliveryPolicy delivery_policy = DEFAULT_DELIVERY_POLICY;
+  unsigned int   max_clients     = DEFAULT_MAX_CLIENTS;
+  RealtimeSetup  realtime        = { .lock_memory = false };
+  bool           udp             = false;
+  bool           calibrate       = false;
+  struct sockaddr_in udp_address;
+  MidiOutput     midi            = { false, 0, false };
+  bool           midi_options    = false; // --midi-channel or --midi-14bit
+  bool           cv_output       = false;
+  sample_t       cv_smoothing    = CV_DEFAULT_SMOOTHING_MS;
+  bool           cv_options      = false; // --cv-smoothing
+  unsigned int   stats_interval  = 0;
+  sample_t       hysteresis      = 0.0f;
+  CurveType      curve           = CURVE_LINEAR;
+  char           *curve_path     = NULL; // recorded curve for --curve
+  char           *curve_record_path = NULL;
+  char           *profile_path   = NULL; // --profile
+  char           *profile_record_path = NULL; // --auto-calibrate
+  char           *control_path   = NULL;
+  char           *shm_name       = NULL;
+  sample_t       one_euro[2]     = { 0.0f, 0.0f }; // min cutoff, beta
+  bool           latency_test_mode = false;
+  OscillatorType oscillator_type = OSCILLATOR_WAVETABLE;
+  DetectorType   detector        = DETECTOR_RMS;
+  RmsMode        rms_mode        = RMS_MODE_TUMBLING;
+  jack_nframes_t rms_hop_size    = 0;
+  bool           benchmark       = false;
+  bool           benchmark_throughput_mode = false;
+  bool           self_test_mode = false;
+  char           *offline_path   = NULL;
+  jack_nframes_t offline_sample_rate = 48000; // for raw captures
+  jack_nframes_t offline_buffer_size = 256;
+  bool           offline_options = false; // --sample-rate or --buffer-size
+
+  LOG("Parsing command-line arguments…");
+
+  for (int i = 1; i < argc; ++i) {
+    if (EQ(argv[i], "--help") || EQ(argv[i], "-h") || EQ(argv[i], "-?")) {
+      show_usage(stdout, argv[0]);
+      return EXIT_SUCCESS;
+    } else if (
+      EQ(argv[i], "-l") || EQ(argv[i], "--lower") ||
+      EQ(argv[i], "-u") || EQ(argv[i], "--upper")
+    ) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      double x[MAX_CHANNELS];
+      int count = parse_numbers_list(argv[i], x, MAX_CHANNELS);
+      bool is_lower = EQ(argv[i-1], "-l") || EQ(argv[i-1], "--lower");
+
+      for (int j = 0; j < count; ++j) {
+        // “float”’s range must be enough, it’s in decibels after all.
+        if (x[j] < -FLT_MAX || x[j] > FLT_MAX) count = -1;
+        else if (is_lower) rms_min_bounds[j] = (float)x[j];
+        else rms_max_bounds[j] = (float)x[j];
+      }
+
+      if (count < 1) {
+        fprintf( stderr
+               , "Incorrect floating point value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (is_lower) {
+        rms_min_bounds_count = count;
+        LOG("Setting min RMS to %s dB…", argv[i]);
+      } else {
+        rms_max_bounds_count = count;
+        LOG("Setting max RMS to %s dB…", argv[i]);
+      }
+    } else if (EQ(argv[i], "-c") || EQ(argv[i], "--calibrate")) {
+      calibrate = true;
+      LOG("Turning calibration mode on…");
+    } else if (
+      EQ(argv[i], "--auto-calibrate") || EQ(argv[i], "--profile")
+    ) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (EQ(argv[i-1], "--profile")) {
+        profile_path = argv[i];
+        LOG("Setting calibration profile to “%s”…", argv[i]);
+      } else {
+        calibrate = true;
+        profile_record_path = argv[i];
+        LOG("Turning automatic calibration mode on (profile “%s”)…", argv[i]);
+      }
+    } else if (EQ(argv[i], "-b") || EQ(argv[i], "--binary")) {
+      output_format = OUTPUT_FORMAT_BINARY;
+      LOG("Setting stdout output format to binary mode…");
+    } else if (EQ(argv[i], "--format")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if ( ! parse_output_format(argv[i], &output_format)) {
+        fprintf( stderr
+               , "Unknown output format “%s” provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      LOG("Setting output format to “%s”…", argv[i]);
+    } else if (EQ(argv[i], "-s") || EQ(argv[i], "--socket")) {
+      socket_server = true;
+      LOG("Turning on socket server on…");
+    } else if (EQ(argv[i], "-f") || EQ(argv[i], "--frequency")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      double x[MAX_CHANNELS];
+      int count = parse_numbers_list(argv[i], x, MAX_CHANNELS);
+
+      for (int j = 0; j < count; ++j) {
+        if (x[j] < 1 || x[j] > UINT32_MAX || x[j] != floor(x[j])) count = -1;
+        else sine_wave_freqs[j] = (sample_t)x[j];
+      }
+
+      if (count < 1) {
+        fprintf( stderr
+               , "Incorrect unsigned integer (starting from 1) value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      sine_wave_freqs_count = count;
+      LOG("Setting sine wave frequency to %s Hz…", argv[i]);
+    } else if (EQ(argv[i], "-w") || EQ(argv[i], "--rms-window")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      double x[MAX_CHANNELS];
+      int count = parse_numbers_list(argv[i], x, MAX_CHANNELS);
+
+      for (int j = 0; j < count; ++j) {
+        if (x[j] < 1 || x[j] > JACK_MAX_FRAMES || x[j] != floor(x[j])) count = -1;
+        else rms_window_sizes[j] = (jack_nframes_t)x[j];
+      }
+
+      if (count < 1) {
+        fprintf( stderr
+               , "Incorrect unsigned integer (starting from 1) value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      rms_window_sizes_count = count;
+      LOG("Setting RMS window size to %s samples…", argv[i]);
+    } else if (EQ(argv[i], "-n") || EQ(argv[i], "--channels")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      long int x = atol(argv[i]);
+
+      if (x < 1 || x > MAX_CHANNELS) {
+        fprintf( stderr
+               , "Incorrect amount of channels (from 1 to %d) “%s” "
+                 "argument provided for “%s”!\n\n"
+               , MAX_CHANNELS
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      channels_count = (unsigned int)x;
+      LOG("Setting amount of channels to %d…", channels_count);
+    } else if (EQ(argv[i], "-t") || EQ(argv[i], "--tones-per-port")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      long int x = atol(argv[i]);
+
+      if (x < 1 || x > MAX_CHANNELS) {
+        fprintf( stderr
+               , "Incorrect amount of tones per port (from 1 to %d) “%s” "
+                 "argument provided for “%s”!\n\n"
+               , MAX_CHANNELS
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      tones_per_port = (unsigned int)x;
+      LOG("Setting amount of tones per port to %d…", tones_per_port);
+    } else if (EQ(argv[i], "--detector")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (EQ(argv[i], "rms")) {
+        detector = DETECTOR_RMS;
+      } else if (EQ(argv[i], "lockin")) {
+        detector = DETECTOR_LOCKIN;
+      } else {
+        fprintf( stderr
+               , "Unknown detector “%s” provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      LOG("Setting detector to “%s”…", argv[i]);
+    } else if (EQ(argv[i], "--benchmark-detectors")) {
+      benchmark = true;
+      LOG("Turning detectors benchmark mode on…");
+    } else if (EQ(argv[i], "--stats")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      long int x = atol(argv[i]);
+
+      if (x < 1 || x > UINT16_MAX) {
+        fprintf( stderr
+               , "Incorrect unsigned integer (starting from 1) value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      stats_interval = (unsigned int)x;
+      LOG("Setting realtime stats interval to %u seconds…", stats_interval);
+    } else if (EQ(argv[i], "--curve")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (EQ(argv[i], "linear")) {
+        curve = CURVE_LINEAR;
+      } else if (EQ(argv[i], "log")) {
+        curve = CURVE_LOG;
+      } else if (EQ(argv[i], "exp")) {
+        curve = CURVE_EXP;
+      } else if (EQ(argv[i], "s-curve")) {
+        curve = CURVE_S;
+      } else {
+        curve = CURVE_POINTS;
+        curve_path = argv[i];
+      }
+
+      LOG("Setting response curve to “%s”…", argv[i]);
+    } else if (EQ(argv[i], "--record-curve")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      curve_record_path = argv[i];
+      LOG("Setting response curve recording file to “%s”…", argv[i]);
+    } else if (EQ(argv[i], "--control")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      control_path = argv[i];
+      LOG("Setting control socket to “%s”…", argv[i]);
+    } else if (EQ(argv[i], "--shm")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (argv[i][0] != '/' || strchr(argv[i] + 1, '/') != NULL || argv[i][1] == '\0') {
+        fprintf( stderr
+               , "Incorrect shared memory name “%s” provided for “%s” "
+                 "(must be like “/expression-pedal”)!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      shm_name = argv[i];
+      LOG("Setting shared memory segment to “%s”…", argv[i]);
+    } else if (EQ(argv[i], "--lock-memory")) {
+      realtime.lock_memory = true;
+      LOG("Turning memory locking on…");
+    } else if (EQ(argv[i], "--consumer-priority")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      long int x = atol(argv[i]);
+
+      if (x < 1 || x > sched_get_priority_max(SCHED_FIFO)) {
+        fprintf( stderr
+               , "Incorrect unsigned integer (from 1 to %d) value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , sched_get_priority_max(SCHED_FIFO)
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      realtime.consumer_priority = (int)x;
+      LOG("Setting consumer thread priority to %d…", realtime.consumer_priority);
+    } else if (EQ(argv[i], "--pin-cpus")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if ( ! parse_cpus(argv[i], &realtime.cpus)) {
+        fprintf( stderr
+               , "Incorrect CPU list “%s” provided for “%s” "
+                 "(must be like “2,3” or “1-3”, there are %ld CPUs)!\n\n"
+               , argv[i]
+               , argv[i-1]
+               , sysconf(_SC_NPROCESSORS_CONF)
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      realtime.pin = true;
+      LOG("Setting CPUs of the threads other than the JACK one to “%s”…", argv[i]);
+    } else if (EQ(argv[i], "--hysteresis")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      char *end = NULL;
+      double x = strtod(argv[i], &end);
+
+      if (end == argv[i] || *end != '\0' || x < 0 || x > UINT8_MAX) {
+        fprintf( stderr
+               , "Incorrect non-negative number value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      hysteresis = (sample_t)x;
+      LOG("Setting hysteresis to %s steps…", argv[i]);
+    } else if (EQ(argv[i], "--one-euro")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      double x[2];
+      int count = parse_numbers_list(argv[i], x, 2);
+
+      if (count < 1 || x[0] <= 0 || (count == 2 && x[1] < 0)) {
+        fprintf( stderr
+               , "Incorrect “MIN_CUTOFF[,BETA]” (positive cutoff in Hz, "
+                 "non-negative beta) value “%s” argument provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      one_euro[0] = (sample_t)x[0];
+      one_euro[1] = count == 2 ? (sample_t)x[1] : 0.0f;
+      LOG("Setting One-Euro filter to %s…", argv[i]);
+    } else if (EQ(argv[i], "--latency-test")) {
+      latency_test_mode = true;
+      LOG("Turning latency test mode on…");
+    } else if (EQ(argv[i], "--benchmark-throughput")) {
+      benchmark_throughput_mode = true;
+      LOG("Turning throughput benchmark mode on…");
+    } else if (EQ(argv[i], "--self-test")) {
+      self_test_mode = true;
+      LOG("Turning self-test mode on…");
+    } else if (EQ(argv[i], "--offline")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      offline_path = argv[i];
+      LOG("Turning offline mode on (capture: %s)…", argv[i]);
+    } else if (EQ(argv[i], "--sample-rate") || EQ(argv[i], "--buffer-size")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      long int x = atol(argv[i]);
+
+      if (x < 1 || x > JACK_MAX_FRAMES) {
+        fprintf( stderr
+               , "Incorrect unsigned integer (starting from 1) value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (EQ(argv[i-1], "--sample-rate")) offline_sample_rate = x;
+      else offline_buffer_size = x;
+      offline_options = true;
+      LOG("Setting offline %s to %ld…", argv[i-1] + 2, x);
+    } else if (EQ(argv[i], "--delivery")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if ( ! parse_delivery_policy(argv[i], &delivery_policy)) {
+        fprintf( stderr
+               , "Unknown delivery policy “%s” provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      LOG("Setting delivery policy of socket clients to “%s”…", argv[i]);
+    } else if (EQ(argv[i], "--max-clients")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
 
-    int err = pthread_create(
-      &socket_connection_handler_tid,
-      NULL,
-      &socket_client_handle,
-      (void *)state
-    );
+      long int x = atol(argv[i]);
 
-    if (err != 0) ERR("Failed to create a thread: [%s]", strerror(err));
+      if (x < 1 || x > MAX_MAX_CLIENTS) {
+        fprintf( stderr
+               , "Incorrect unsigned integer (from 1 to %d) value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , MAX_MAX_CLIENTS
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
 
-    LOG(
-      "Spawned a thread for handling client socket connection (thread id: %ld).",
-      socket_connection_handler_tid
-    );
-  }
+      max_clients = (unsigned int)x;
+      LOG("Setting max amount of socket clients to %u…", max_clients);
+    } else if (EQ(argv[i], "--udp")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
 
-  LOG("Setting shutdown callbacks…");
-  shutdown_payload.value_updates_handler_tid = value_updates_handler_tid;
-  shutdown_payload.state = state;
-  jack_on_shutdown(state->jack_client, jack_shutdown_callback, NULL);
-  signal(SIGABRT, sig_handler);
-  signal(SIGHUP,  sig_handler);
-  signal(SIGINT,  sig_handler);
-  signal(SIGQUIT, sig_handler);
-  signal(SIGTERM, sig_handler);
+      if ( ! parse_udp_address(argv[i], &udp_address)) {
+        fprintf( stderr
+               , "Incorrect IPv4 address “%s” provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
 
-  if (binary_output)
-    fprintf(
-      stderr,
-      "Playing sine wave, analyzing returned signal and %s "
-      "as 8-bit binary unsigned integers (in range from 0 to %d)…\n",
-      socket_server
-        ? "sending detected values to socket server clients"
-        : "printing detected values to stdout",
-      UINT8_MAX
-    );
-  else
-    fprintf(
-      stderr,
-      "Playing sine wave, analyzing returned signal and %s "
-      "as lines with human-readable text with numbers "
-      "(in range from 0 to %d)…\n",
-      socket_server
-        ? "sending detected values to socket server clients"
-        : "printing detected values to stdout",
-      UINT8_MAX
-    );
+      udp = true;
+      LOG("Turning UDP sender on (destination: %s)…", argv[i]);
+    } else if (EQ(argv[i], "--midi-cc")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
 
-  if (jack_activate(state->jack_client) != 0)
-    ERRJACK("Client activation failed!");
+      double x[MAX_CHANNELS];
+      int count = parse_numbers_list(argv[i], x, MAX_CHANNELS);
 
-  pthread_join(value_updates_handler_tid, NULL);
-  /* sleep(-1); */
-}
+      for (int j = 0; j < count; ++j) {
+        if (x[j] < 0 || x[j] > 119 || x[j] != floor(x[j])) count = -1;
+        else midi_ccs[j] = (uint8_t)x[j];
+      }
 
-void show_usage(FILE *out, char *app)
-{
-  size_t i = 0;
-  char spaces[128];
-  for (i = 0; i < strlen(app); ++i) spaces[i] = ' ';
-  spaces[i] = '\0';
-  fprintf(out, "Usage: %s -l|--lower FLOAT\n", app);
-  fprintf(out, "       %s -u|--upper FLOAT\n", spaces);
-  fprintf(out, "       %s [-c|--calibrate]\n", spaces);
-  fprintf(out, "       %s [-b|--binary]\n", spaces);
-  fprintf(out, "       %s [-s|--socket]\n", spaces);
-  fprintf(out, "       %s [-f|--frequency UINT]\n", spaces);
-  fprintf(out, "       %s [-w|--rms-window UINT]\n", spaces);
-  fprintf(out, "\n");
-  fprintf(out, "For me (the author of the program) the range between -90 dB and -6 dB works well:\n");
-  fprintf(out, "  %s -l -90 -u -6\n", app);
-  fprintf(out, "\n");
-  fprintf(out, "Available options:\n");
-  fprintf(out, "  -l,--lower FLOAT      Set min RMS in dB (see --calibrate).\n");
-  fprintf(out, "  -u,--upper FLOAT      Set max RMS in dB (see --calibrate).\n");
-  fprintf(out, "  -c,--calibrate        Calibrate min and max RMS bounds.\n");
-  fprintf(out, "                        Set your pedal to minimum position and record the value.\n");
-  fprintf(out, "                        Then do the same for maximum position.\n");
-  fprintf(out, "                        Use those values for --lower and --upper arguments.\n");
-  fprintf(out, "  -b,--binary           Print binary unsigned 8-bit integers sequence\n");
-  fprintf(out, "                        instead of human-readable lines.\n");
-  fprintf(out, "  -s,--socket           Start socket server on port %d and send\n", socket_port);
-  fprintf(out, "                        8-bit integers sequence to connected clients\n");
-  fprintf(out, "                        (as human-readable lines by default and\n");
-  fprintf(out, "                        as binary stream with --binary).\n");
-  fprintf(out, "  -f,--frequency UINT   Frequency in Hz of a sine wave to send\n");
-  fprintf(out, "                        (default value is 440).\n");
-  fprintf(out, "  -w,--rms-window UINT  RMS window size in amount of samples\n");
-  fprintf(out, "                        (default value is one rotation of the sine wave,\n");
-  fprintf(out, "                        so sample rate divided by --frequency,\n");
-  fprintf(out, "                        so for 48000 sample rate and 440 Hz --frequency\n");
-  fprintf(out, "                        it will be ≈109).\n");
-  fprintf(out, "  -h,-?,--help          Show this help text.\n");
-}
+      if (count < 1) {
+        fprintf( stderr
+               , "Incorrect MIDI controller number (from 0 to 119) value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
 
-int main(int argc, char *argv[])
-{
-  LOG("Starting of application…");
+      midi_ccs_count = count;
+      midi.enabled = true;
+      LOG("Setting MIDI controller numbers to %s…", argv[i]);
+    } else if (EQ(argv[i], "--midi-channel")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
 
-  RmsBounds      rms_bounds      = { -1, -1 };
-  bool           has_rms_min     = false;
-  bool           has_rms_max     = false;
-  bool           binary_output   = false;
-  bool           socket_server   = false;
-  bool           calibrate       = false;
-  jack_nframes_t rms_window_size = 0;
-  sample_t       sine_wave_freq  = 0;
+      long int x = atol(argv[i]);
 
-  LOG("Parsing command-line arguments…");
+      if (x < 1 || x > 16) {
+        fprintf( stderr
+               , "Incorrect MIDI channel (from 1 to 16) value “%s” "
+                 "argument provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
 
-  for (int i = 1; i < argc; ++i) {
-    if (EQ(argv[i], "--help") || EQ(argv[i], "-h") || EQ(argv[i], "-?")) {
-      show_usage(stdout, argv[0]);
-      return EXIT_SUCCESS;
-    } else if (
-      EQ(argv[i], "-l") || EQ(argv[i], "--lower") ||
-      EQ(argv[i], "-u") || EQ(argv[i], "--upper")
-    ) {
+      midi.channel = (uint8_t)(x - 1);
+      midi_options = true;
+      LOG("Setting MIDI channel to %ld…", x);
+    } else if (EQ(argv[i], "--midi-14bit")) {
+      midi.fine = true;
+      midi_options = true;
+      LOG("Turning 14-bit MIDI Control Change messages on…");
+    } else if (EQ(argv[i], "--cv")) {
+      cv_output = true;
+      LOG("Turning control signal output on…");
+    } else if (EQ(argv[i], "--cv-smoothing")) {
       if (++i >= argc) {
         fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
         show_usage(stderr, argv[0]);
         return EXIT_FAILURE;
       }
 
-      double x = atof(argv[i]);
+      char *end = NULL;
+      double x = strtod(argv[i], &end);
 
-      // “float”’s range must be enough, it’s in decibels after all.
-      if (x < -FLT_MAX || x > FLT_MAX) {
+      if (end == argv[i] || *end != '\0' || x < 0) {
         fprintf( stderr
-               , "Incorrect floating point value “%s” "
+               , "Incorrect non-negative number value “%s” "
                  "argument provided for “%s”!\n\n"
                , argv[i]
                , argv[i-1]
@@ -1038,25 +7384,32 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
       }
 
-      if (EQ(argv[i-1], "-l") || EQ(argv[i-1], "--lower")) {
-        rms_bounds.rms_min_bound = (float)x;
-        has_rms_min = true;
-        LOG("Setting min RMS to %f dB…", rms_bounds.rms_min_bound);
+      cv_smoothing = (sample_t)x;
+      cv_options = true;
+      LOG("Setting control signal smoothing to %s ms…", argv[i]);
+    } else if (EQ(argv[i], "--rms-mode")) {
+      if (++i >= argc) {
+        fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (EQ(argv[i], "tumbling")) {
+        rms_mode = RMS_MODE_TUMBLING;
+      } else if (EQ(argv[i], "sliding")) {
+        rms_mode = RMS_MODE_SLIDING;
       } else {
-        rms_bounds.rms_max_bound = (float)x;
-        has_rms_max = true;
-        LOG("Setting max RMS to %f dB…", rms_bounds.rms_max_bound);
+        fprintf( stderr
+               , "Unknown RMS mode “%s” provided for “%s”!\n\n"
+               , argv[i]
+               , argv[i-1]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
       }
-    } else if (EQ(argv[i], "-c") || EQ(argv[i], "--calibrate")) {
-      calibrate = true;
-      LOG("Turning calibration mode on…");
-    } else if (EQ(argv[i], "-b") || EQ(argv[i], "--binary")) {
-      binary_output = true;
-      LOG("Setting stdout output format to binary mode…");
-    } else if (EQ(argv[i], "-s") || EQ(argv[i], "--socket")) {
-      socket_server = true;
-      LOG("Turning on socket server on…");
-    } else if (EQ(argv[i], "-f") || EQ(argv[i], "--frequency")) {
+
+      LOG("Setting RMS mode to “%s”…", argv[i]);
+    } else if (EQ(argv[i], "--hop")) {
       if (++i >= argc) {
         fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
         show_usage(stderr, argv[0]);
@@ -1065,7 +7418,7 @@ int main(int argc, char *argv[])
 
       long int x = atol(argv[i]);
 
-      if (x < 1 || x > UINT32_MAX) {
+      if (x < 1 || x > JACK_MAX_FRAMES) {
         fprintf( stderr
                , "Incorrect unsigned integer (starting from 1) value “%s” "
                  "argument provided for “%s”!\n\n"
@@ -1076,21 +7429,24 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
       }
 
-      sine_wave_freq = (sample_t)x;
-      LOG("Setting sine wave frequency to %f Hz…", sine_wave_freq);
-    } else if (EQ(argv[i], "-w") || EQ(argv[i], "--rms-window")) {
+      rms_hop_size = (jack_nframes_t)x;
+      LOG("Setting RMS hop size to %d samples…", rms_hop_size);
+    } else if (EQ(argv[i], "-o") || EQ(argv[i], "--oscillator")) {
       if (++i >= argc) {
         fprintf(stderr, "There must be a value after “%s” argument!\n\n", argv[--i]);
         show_usage(stderr, argv[0]);
         return EXIT_FAILURE;
       }
 
-      long int x = atol(argv[i]);
-
-      if (x < 1 || x > JACK_MAX_FRAMES) {
+      if (EQ(argv[i], "sin")) {
+        oscillator_type = OSCILLATOR_SIN;
+      } else if (EQ(argv[i], "wavetable")) {
+        oscillator_type = OSCILLATOR_WAVETABLE;
+      } else if (EQ(argv[i], "recursive")) {
+        oscillator_type = OSCILLATOR_RECURSIVE;
+      } else {
         fprintf( stderr
-               , "Incorrect unsigned integer (starting from 1) value “%s” "
-                 "argument provided for “%s”!\n\n"
+               , "Unknown oscillator “%s” provided for “%s”!\n\n"
                , argv[i]
                , argv[i-1]
                );
@@ -1098,8 +7454,7 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
       }
 
-      rms_window_size = (jack_nframes_t)x;
-      LOG("Setting RMS window size to %d samples…", rms_window_size);
+      LOG("Setting oscillator to “%s”…", argv[i]);
     } else {
       fprintf(stderr, "Incorrect argument: “%s”!\n\n", argv[i]);
       show_usage(stderr, argv[0]);
@@ -1107,36 +7462,275 @@ int main(int argc, char *argv[])
     }
   }
 
-  if (calibrate) {
-    fprintf(stderr, "Running in calibration mode…\n");
-  } else if ( ! has_rms_min || ! has_rms_max) {
+  if (profile_path != NULL) {
+    if (rms_min_bounds_count != 0 || rms_max_bounds_count != 0) {
+      fprintf(stderr, "Use either --profile or --lower and --upper, not both!\n\n");
+      show_usage(stderr, argv[0]);
+      return EXIT_FAILURE;
+    }
+
+    if ( ! load_profile(
+      profile_path,
+      rms_min_bounds,
+      rms_max_bounds,
+      &rms_min_bounds_count
+    )) return EXIT_FAILURE;
+
+    rms_max_bounds_count = rms_min_bounds_count;
+  }
+
+  {
+    int counts[] = {
+      rms_min_bounds_count,
+      rms_max_bounds_count,
+      sine_wave_freqs_count,
+      rms_window_sizes_count,
+      midi_ccs_count,
+    };
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(int); ++i) {
+      if (counts[i] <= 1) continue;
+
+      if (channels_count == 0) {
+        channels_count = counts[i];
+      } else if (channels_count != (unsigned int)counts[i]) {
+        fprintf( stderr
+               , "Lists of per-channel values must be of the same length "
+                 "(%d and %d) and match --channels!\n\n"
+               , channels_count
+               , counts[i]
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+
+    if (channels_count == 0) channels_count = 1;
+  }
+
+  if (benchmark) {
+    benchmark_detectors(
+      sine_wave_freqs_count == 0 ? 440.0f : sine_wave_freqs[0]
+    );
+
+    return EXIT_SUCCESS;
+  } else if (benchmark_throughput_mode) {
+    benchmark_throughput();
+    return EXIT_SUCCESS;
+  } else if (self_test_mode) {
+    return self_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+  } else if (offline_options && offline_path == NULL) {
+    fprintf(stderr, "--sample-rate and --buffer-size require --offline!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (
+    offline_path != NULL
+    && (socket_server || udp || midi.enabled || cv_output)
+  ) {
+    fprintf( stderr
+           , "--offline writes values to stdout, it can not be combined "
+             "with --socket, --udp, --midi-cc or --cv!\n\n"
+           );
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (detector == DETECTOR_LOCKIN && rms_mode == RMS_MODE_SLIDING) {
+    fprintf(stderr, "Sliding --rms-mode is not supported by lockin detector!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (rms_hop_size != 0 && rms_mode != RMS_MODE_SLIDING) {
+    fprintf(stderr, "--hop requires sliding --rms-mode!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (udp && socket_server) {
+    fprintf(stderr, "Use either --socket or --udp, not both!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (cv_options && ! cv_output) {
+    fprintf(stderr, "--cv-smoothing requires --cv!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (midi_options && ! midi.enabled) {
+    fprintf(stderr, "--midi-channel and --midi-14bit require --midi-cc!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (tones_per_port > 1 && rms_mode == RMS_MODE_SLIDING) {
+    fprintf(stderr, "Sliding --rms-mode is not supported with --tones-per-port!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (control_path != NULL && (offline_path != NULL || calibrate)) {
+    fprintf(stderr, "--control can not be combined with --offline or calibration!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (
+    (realtime.lock_memory || realtime.consumer_priority > 0 || realtime.pin)
+    && (offline_path != NULL || latency_test_mode)
+  ) {
     fprintf( stderr
-           , "RMS bounds were not provided, run with --calibrate "
-             "to get the values first!\n\n"
+           , "--lock-memory, --consumer-priority and --pin-cpus require JACK, "
+             "not --offline or --latency-test!\n\n"
            );
     show_usage(stderr, argv[0]);
     return EXIT_FAILURE;
-  } else if (rms_bounds.rms_max_bound <= rms_bounds.rms_min_bound) {
-    fprintf(stderr, "RMS max bound must be higher than min bound!\n\n");
+  } else if (shm_name != NULL && (offline_path != NULL || calibrate)) {
+    fprintf(stderr, "--shm can not be combined with --offline or calibration!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (profile_record_path != NULL && offline_path != NULL) {
+    fprintf(stderr, "--auto-calibrate requires JACK, not --offline!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (profile_record_path != NULL && curve_record_path != NULL) {
+    fprintf(stderr, "Use either --auto-calibrate or --record-curve, not both!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (curve_record_path != NULL && ( ! calibrate || offline_path != NULL)) {
+    fprintf(stderr, "--record-curve requires --calibrate and JACK!\n\n");
+    show_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  } else if (profile_record_path != NULL) {
+    fprintf(stderr, "Running in automatic calibration mode…\n");
+  } else if (calibrate) {
+    fprintf(stderr, "Running in calibration mode…\n");
+  } else if (latency_test_mode) {
+    fprintf(stderr, "Running latency test (bounds are set by the test)…\n");
+  } else if (rms_min_bounds_count == 0 || rms_max_bounds_count == 0) {
+    fprintf( stderr
+           , "RMS bounds were not provided, run with --auto-calibrate "
+             "(or --calibrate) to get the values first!\n\n"
+           );
     show_usage(stderr, argv[0]);
     return EXIT_FAILURE;
   }
 
+  // Tones sharing a port pair must be distinguishable
+  for (unsigned int i = 0; tones_per_port > 1 && i < channels_count; ++i) {
+    unsigned int group_start = i - i % tones_per_port;
+
+    for (unsigned int j = group_start; j < i; ++j) {
+      if (
+        sine_wave_freqs_count > 1 &&
+        sine_wave_freqs[i] != sine_wave_freqs[j]
+      ) continue;
+
+      fprintf( stderr
+             , "Channels sharing a port pair (--tones-per-port) must have "
+               "different frequencies (see --frequency)!\n\n"
+             );
+      show_usage(stderr, argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  Channel channels[MAX_CHANNELS];
+
+  for (unsigned int i = 0; i < channels_count; ++i) {
+    Channel *channel = &channels[i];
+    null_channel(channel);
+    channel->number = i + 1;
+    channel->detector = detector;
+    channel->rms_mode = rms_mode;
+    channel->oscillator.type = oscillator_type;
+
+    channel->sine_wave_freq
+      = sine_wave_freqs_count == 0
+      ? 440.0f
+      : LIST_ITEM(sine_wave_freqs, sine_wave_freqs_count, i);
+
+    channel->use_default_rms_window_size = rms_window_sizes_count == 0;
+    if (rms_window_sizes_count != 0)
+      channel->rms_window_size =
+        LIST_ITEM(rms_window_sizes, rms_window_sizes_count, i);
+
+    channel->use_default_rms_hop_size = rms_hop_size == 0;
+    channel->rms_hop_size = rms_hop_size;
+    channel->hysteresis = hysteresis;
+    // The levels of the latency test do not follow any pedal
+    channel->curve = calibrate || latency_test_mode ? CURVE_LINEAR : curve;
+    channel->one_euro_min_cutoff = one_euro[0];
+    channel->one_euro_beta = one_euro[1];
+
+    if (midi_ccs_count != 0) {
+      channel->midi_cc = LIST_ITEM(midi_ccs, midi_ccs_count, i);
+
+      if (midi.fine && channel->midi_cc >= MIDI_CC_LSB_OFFSET) {
+        fprintf( stderr
+               , "14-bit MIDI controller numbers must be from 0 to %d!\n\n"
+               , MIDI_CC_LSB_OFFSET - 1
+               );
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( ! calibrate && ! latency_test_mode) {
+      channel->rms_bounds.rms_min_bound =
+        LIST_ITEM(rms_min_bounds, rms_min_bounds_count, i);
+      channel->rms_bounds.rms_max_bound =
+        LIST_ITEM(rms_max_bounds, rms_max_bounds_count, i);
+
+      if (
+        channel->rms_bounds.rms_max_bound <= channel->rms_bounds.rms_min_bound
+      ) {
+        fprintf(stderr, "RMS max bound must be higher than min bound!\n\n");
+        show_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (
+    channels[0].curve == CURVE_POINTS
+    && ! load_curve(curve_path, channels, channels_count)
+  )
+    return EXIT_FAILURE;
+
+  if (latency_test_mode) {
+    latency_test(&channels[0]);
+    return EXIT_SUCCESS;
+  }
+
+  if (offline_path != NULL) {
+    run_offline(
+      channels,
+      channels_count,
+      tones_per_port,
+      output_format,
+      offline_path,
+      offline_sample_rate,
+      offline_buffer_size,
+      calibrate
+    );
+
+    return EXIT_SUCCESS;
+  }
+
   run(
-    rms_bounds,
-    sine_wave_freq,
-    rms_window_size,
-    binary_output,
+    channels,
+    channels_count,
+    tones_per_port,
+    output_format,
     socket_server,
-    calibrate
+    delivery_policy,
+    max_clients,
+    udp ? &udp_address : NULL,
+    midi,
+    cv_output ? cv_smoothing / 1000 : -1.0f,
+    stats_interval,
+    calibrate,
+    curve_record_path,
+    profile_record_path,
+    control_path,
+    shm_name,
+    realtime
   );
 
   return EXIT_SUCCESS;
 }
 
 // Root Mean Square (RMS) calculation.
-// This function isn’t used in the code, it’s inlined where needed.
-// Just useful to see the reference implementation.
+// This function isn’t used in the code, see “sum_of_squares()”.
+// Just useful to see the reference implementation
+// (and to validate “sum_of_squares()” against it, see “--self-test”).
 inline sample_t rms(sample_t *samples_list, jack_nframes_t window_size)
 {
   sample_t sum = 0.0f;
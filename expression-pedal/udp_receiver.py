@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+# expression pedal UDP receiver (see “--udp” option of expression-pedal)
+#
+# Prints received values as “CHANNEL VALUE” lines to stdout and statistics
+# (lost and stale datagrams, jitter) to stderr. For instance over loopback:
+#   ./build/expression-pedal -l -90 -u -6 --udp 127.0.0.1
+#   ./udp_receiver.py 127.0.0.1
+# or with multicast:
+#   ./build/expression-pedal -l -90 -u -6 --udp 239.0.0.1
+#   ./udp_receiver.py 239.0.0.1
+
+import socket
+import struct
+from sys  import argv, stderr, exit
+from time import monotonic
+
+
+DEFAULT_PORT   = 31416
+STATS_INTERVAL = 5 # in seconds
+
+# Must be in sync with “UDP_DATAGRAM_VERSION” and the layout described
+# next to it in “src/main.c”
+DATAGRAM_VERSION = 1
+DATAGRAM         = struct.Struct('!BBBxIII') # version, channel, value,
+                                             # sequence, frame time, sample rate
+
+
+class Stats:
+
+  def __init__(self):
+    self.received = 0
+    self.lost     = 0 # gaps in sequence numbers
+    self.stale    = 0 # came after a newer datagram, dropped
+    self.invalid  = 0
+    self.jitter   = 0.0 # in seconds (RFC 3550 interarrival jitter)
+    self.last_transit = None
+
+  def update_jitter(self, arrival, frame_time, sample_rate):
+    # Only the variation of the transit time matters, so the offset between
+    # the JACK clock and the local one cancels out
+    transit = arrival - frame_time / sample_rate
+
+    if self.last_transit is not None:
+      d = abs(transit - self.last_transit)
+      self.jitter += (d - self.jitter) / 16
+
+    self.last_transit = transit
+
+  def report(self):
+    print(
+      'received: {}, lost: {}, stale: {}, invalid: {}, jitter: {:.3f} ms'
+        .format(
+          self.received,
+          self.lost,
+          self.stale,
+          self.invalid,
+          self.jitter * 1000
+        ),
+      file=stderr
+    )
+
+
+def parse_address(arg):
+  host, _, port = arg.partition(':')
+  return host, int(port) if port else DEFAULT_PORT
+
+
+def open_socket(host, port):
+  s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+  s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+
+  if socket.inet_aton(host)[0] & 0xf0 == 0xe0: # multicast (224.0.0.0/4)
+    s.bind(('', port))
+    membership = struct.pack('4s4s', socket.inet_aton(host), socket.inet_aton('0.0.0.0'))
+    s.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+  else:
+    s.bind((host, port))
+
+  return s
+
+
+def main():
+  if len(argv) > 2:
+    print('Usage: {} [ADDRESS[:PORT]]'.format(argv[0]), file=stderr)
+    exit(1)
+
+  host, port = parse_address(argv[1] if len(argv) == 2 else '0.0.0.0')
+  s = open_socket(host, port)
+  print('Receiving datagrams on {}:{}…'.format(host, port), file=stderr)
+
+  stats         = Stats()
+  last_sequence = None
+  last_report   = monotonic()
+
+  try:
+    while True:
+      data = s.recv(64)
+      arrival = monotonic()
+
+      if len(data) != DATAGRAM.size or data[0] != DATAGRAM_VERSION:
+        stats.invalid += 1
+        continue
+
+      version, channel, value, sequence, frame_time, sample_rate = \
+        DATAGRAM.unpack(data)
+
+      stats.received += 1
+
+      if last_sequence is not None:
+        # Sequence numbers wrap around, so compare them modulo 2^32
+        delta = (sequence - last_sequence) & 0xffffffff
+
+        if delta == 0 or delta >= 0x80000000:
+          stats.stale += 1
+          continue
+
+        stats.lost += delta - 1
+
+      last_sequence = sequence
+      if sample_rate > 0: stats.update_jitter(arrival, frame_time, sample_rate)
+      print(channel, value, flush=True)
+
+      if arrival - last_report >= STATS_INTERVAL:
+        stats.report()
+        last_report = arrival
+
+  except (KeyboardInterrupt, SystemExit):
+    stats.report()
+    s.close()
+
+
+if __name__ == '__main__':
+  main()